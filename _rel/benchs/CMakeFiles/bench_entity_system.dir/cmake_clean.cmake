@@ -0,0 +1,11 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/bench_entity_system.dir/bench_entity_system.cc.o"
+  "CMakeFiles/bench_entity_system.dir/bench_entity_system.cc.o.d"
+  "bench_entity_system"
+  "bench_entity_system.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang CXX)
+  include(CMakeFiles/bench_entity_system.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
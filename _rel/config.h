@@ -0,0 +1,9 @@
+#ifndef CONFIG_H_
+# define CONFIG_H_N
+
+# define ENTITY_SYSTEM_TESTS_DIR  "/root/repo/tests/"
+# define ENTITY_SYSTEM_DEMOS_DIR  "/root/repo/demos/"
+# define ENTITY_SYSTEM_BENCHS_DIR "/root/repo/benchs/"
+
+#endif
+
@@ -0,0 +1,43 @@
+#ifndef ENTITY_SYSTEM_BENCH_HPP
+# define ENTITY_SYSTEM_BENCH_HPP
+
+# include <chrono>
+# include <iostream>
+# include <iomanip>
+# include <string>
+
+//
+// minimal benchmark helper : run functor several times and print the best time
+template <class F> double bench(const std::string& name, size_t nb_items, F && functor, size_t nb_runs = 5)
+{
+  typedef std::chrono::high_resolution_clock clock_type;
+
+  double best = -1;
+  for(size_t run = 0 ; run < nb_runs ; ++run)
+  {
+    clock_type::time_point start = clock_type::now();
+    functor();
+    clock_type::time_point stop  = clock_type::now();
+
+    double elapsed = std::chrono::duration<double, std::nano>(stop - start).count();
+    if(best < 0 || elapsed < best)
+    {
+      best = elapsed;
+    }
+  }
+
+  std::cout << std::left  << std::setw(48) << name
+            << std::right << std::setw(12) << std::fixed << std::setprecision(3) << best / 1e6 << " ms"
+            << std::setw(12) << std::setprecision(3) << (nb_items ? best / nb_items : 0.) << " ns/item"
+            << std::endl;
+  return best;
+}
+
+//
+// prevent compiler to remove computation
+template <class T> void do_not_optimize(T const& value)
+{
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+#endif
@@ -0,0 +1,480 @@
+#include "bench.hpp"
+#include <entity_system/entity_system.hpp>
+
+#include <random>
+#include <algorithm>
+
+namespace
+{
+  struct position
+  {
+    position(float x, float y)
+      : x(x)
+      , y(y)
+    {
+    }
+
+    float x;
+    float y;
+  };
+
+  struct velocity
+  {
+    velocity(float x, float y)
+      : x(x)
+      , y(y)
+    {
+    }
+
+    float x;
+    float y;
+  };
+
+  struct packed_velocity
+  {
+    packed_velocity(float x, float y)
+      : x(x)
+      , y(y)
+    {
+    }
+
+    float x;
+    float y;
+  };
+
+  template <size_t I> struct value
+  {
+    value(float v)
+      : v(v)
+    {
+    }
+
+    float v;
+  };
+
+  // same components stored by archetype
+  template <size_t I> struct packed_value : value<I>
+  {
+    using value<I>::value;
+  };
+
+  template <size_t I> struct body
+  {
+    body()
+      : x(0), y(0), vx(0), vy(0)
+    {
+    }
+
+    body(float x, float y, float vx, float vy)
+      : x(x), y(y), vx(vx), vy(vy)
+    {
+    }
+
+    float x;
+    float y;
+    float vx;
+    float vy;
+  };
+
+  // pool filled in random entity order, walked with a prefetch distance of D
+  template <size_t D> struct shuffled : value<D>
+  {
+    using value<D>::value;
+  };
+
+  // one cache line
+  struct payload
+  {
+    payload(float v)
+      : v(v)
+    {
+    }
+
+    float v;
+    float pad[15];
+  };
+
+  typedef body<0> aos_body;
+  typedef body<1> dense_body;
+  typedef body<2> soa_body;
+
+  struct event {};
+}
+
+namespace entity_system
+{
+  template <> struct component_storage<packed_velocity>
+  {
+    typedef sparse_set_storage type;
+  };
+
+  template <size_t I> struct component_storage<packed_value<I>>
+  {
+    typedef archetype_storage type;
+  };
+
+  template <size_t D> struct component_storage<shuffled<D>>
+  {
+    typedef sparse_set_storage type;
+  };
+
+  template <size_t D> struct prefetch_distance<shuffled<D>> : std::integral_constant<size_t, D>
+  {
+  };
+
+  template <> struct component_storage<dense_body>
+  {
+    typedef sparse_set_storage type;
+  };
+
+  template <> struct component_storage<soa_body>
+  {
+    typedef soa_storage type;
+  };
+
+  template <> struct soa_fields<soa_body>
+  {
+    static auto get()
+    {
+      return std::make_tuple(&soa_body::x, &soa_body::y, &soa_body::vx, &soa_body::vy);
+    }
+  };
+}
+
+namespace
+{
+  typedef entity_system::world<std::tuple<event>, std::tuple<position, velocity, packed_velocity>> world_type;
+  typedef world_type::entity_type                                                                    entity_type;
+
+  typedef entity_system::world<std::tuple<event>, std::tuple<aos_body, dense_body, soa_body>> body_world_type;
+  typedef entity_system::world<std::tuple<event>, std::tuple<shuffled<0>, shuffled<8>, shuffled<32>, payload>> prefetch_world_type;
+  typedef entity_system::world<std::tuple<event>, std::tuple<value<0>, value<1>, value<2>, value<3>, packed_value<0>, packed_value<1>, packed_value<2>, packed_value<3>>> query_world_type;
+
+  void run(size_t nb_entities, double density)
+  {
+    world_type world;
+    auto& em = world.get_entity_manager();
+
+    std::mt19937 gen(42);
+    std::bernoulli_distribution has(density);
+    size_t nb_with = 0;
+    for(size_t i = 0 ; i < nb_entities ; ++i)
+    {
+      entity_type* e = em.new_entity();
+      e->new_component<position>((float)i, (float)i);
+      if(has(gen))
+      {
+        e->new_component<velocity>(1.f, 2.f);
+        e->new_component<packed_velocity>(1.f, 2.f);
+        ++nb_with;
+      }
+    }
+
+    std::string suffix = " density=" + std::to_string(density).substr(0, 5);
+    float sum = 0;
+    bench("for_entities_with<velocity>" + suffix, nb_with, [&]()
+    {
+      em.for_entities_with<velocity>([&](entity_type& e)
+      {
+        sum += e.get_component<velocity>()->x;
+      });
+      do_not_optimize(sum);
+    });
+
+    // filtering only
+    size_t nb_found = 0;
+    auto   mask     = world_type::get_component_mask<position, velocity>();
+    bench("filter masks in entities" + suffix, nb_entities, [&]()
+    {
+      em.for_entities_with<>([&](entity_type& e)
+      {
+        nb_found += ((e.get_component_mask() & mask) == mask);
+      });
+      do_not_optimize(nb_found);
+    });
+
+    bench("filter for_entities_with<position, velocity>" + suffix, nb_entities, [&]()
+    {
+      em.for_entities_with<position, velocity>([&](entity_type&)
+      {
+        ++nb_found;
+      });
+      do_not_optimize(nb_found);
+    });
+
+    bench("for_each_component<velocity> segment" + suffix, nb_with, [&]()
+    {
+      em.for_each_component<velocity>([&](entity_type&, velocity& v)
+      {
+        sum += v.x;
+      });
+      do_not_optimize(sum);
+    });
+
+    bench("for_each_component<velocity> sparse set" + suffix, nb_with, [&]()
+    {
+      em.for_each_component<packed_velocity>([&](entity_type&, packed_velocity& v)
+      {
+        sum += v.x;
+      });
+      do_not_optimize(sum);
+    });
+  }
+
+  //
+  // 3 components query, entities spread over 4 archetypes
+  template <class A, class B, class C, class D> void run_query(const std::string& name, size_t nb_entities)
+  {
+    query_world_type world;
+    auto& em = world.get_entity_manager();
+
+    for(size_t i = 0 ; i < nb_entities ; ++i)
+    {
+      auto* e = em.new_entity();
+      e->new_component<A>(1.f);
+      e->new_component<B>(2.f);
+      if(i % 4 != 3)
+      {
+        e->new_component<C>(3.f);
+      }
+      if(i % 2)
+      {
+        e->new_component<D>(4.f);
+      }
+    }
+
+    size_t nb_matches = nb_entities - nb_entities / 4;
+    float sum = 0;
+    bench("for_entities_with<A,B,C> " + name, nb_matches, [&]()
+    {
+      em.for_entities_with<A, B, C>([&](query_world_type::entity_type& e)
+      {
+        sum += e.get_component<A>()->v + e.get_component<B>()->v * e.get_component<C>()->v;
+      });
+      do_not_optimize(sum);
+    });
+
+    bench("for_each<A,B,C> " + name, nb_matches, [&]()
+    {
+      em.template for_each<A, B, C>([&](query_world_type::entity_type&, A& a, B& b, C& c)
+      {
+        sum += a.v + b.v * c.v;
+      });
+      do_not_optimize(sum);
+    });
+
+    // half of the entities have D
+    bench("for_entities_with<A,B> skip D in lambda " + name, nb_entities / 2, [&]()
+    {
+      em.template for_entities_with<A, B>([&](query_world_type::entity_type& e)
+      {
+        if(!e.get_component<D>())
+        {
+          sum += e.get_component<A>()->v + e.get_component<B>()->v;
+        }
+      });
+      do_not_optimize(sum);
+    });
+
+    bench("for_each<A,B,without<D>> " + name, nb_entities / 2, [&]()
+    {
+      em.template for_each<A, B, entity_system::without<D>>([&](query_world_type::entity_type&, A& a, B& b)
+      {
+        sum += a.v + b.v;
+      });
+      do_not_optimize(sum);
+    });
+
+    auto& group = em.get_group<A, B, C>();
+    bench("group<A,B,C> " + name, group.size(), [&]()
+    {
+      group.for_each([&](query_world_type::entity_type& e)
+      {
+        sum += e.get_component<A>()->v + e.get_component<B>()->v * e.get_component<C>()->v;
+      });
+      do_not_optimize(sum);
+    });
+  }
+
+  //
+  // x += vx * dt over all bodies
+  void run_integrate(size_t nb_entities)
+  {
+    body_world_type world;
+    auto& em = world.get_entity_manager();
+    for(size_t i = 0 ; i < nb_entities ; ++i)
+    {
+      auto* e = em.new_entity();
+      e->new_component<aos_body>(i, i, 1.f, 2.f);
+      e->new_component<dense_body>(i, i, 1.f, 2.f);
+      e->new_component<soa_body>(i, i, 1.f, 2.f);
+    }
+
+    const float dt = 0.5f;
+    bench("integrate segment (AoS)", nb_entities, [&]()
+    {
+      em.for_each_component<aos_body>([&](body_world_type::entity_type&, aos_body& b)
+      {
+        b.x += b.vx * dt;
+        b.y += b.vy * dt;
+      });
+    });
+
+    bench("integrate sparse set (AoS)", nb_entities, [&]()
+    {
+      em.for_each_component<dense_body>([&](body_world_type::entity_type&, dense_body& b)
+      {
+        b.x += b.vx * dt;
+        b.y += b.vy * dt;
+      });
+    });
+
+    bench("integrate sparse set chunks (AoS)", nb_entities, [&]()
+    {
+      em.for_each_chunk<dense_body>([&](size_t n, dense_body* b, const entity_system::entity_id_type*)
+      {
+        for(size_t i = 0 ; i < n ; ++i)
+        {
+          b[i].x += b[i].vx * dt;
+          b[i].y += b[i].vy * dt;
+        }
+      });
+    });
+
+    bench("integrate soa columns", nb_entities, [&]()
+    {
+      auto   columns = em.get_columns<soa_body>();
+      float* x       = columns.column<0>();
+      float* y       = columns.column<1>();
+      float* vx      = columns.column<2>();
+      float* vy      = columns.column<3>();
+      for(size_t i = 0 ; i < columns.size() ; ++i)
+      {
+        x[i] += vx[i] * dt;
+        y[i] += vy[i] * dt;
+      }
+      do_not_optimize(x[0]);
+    });
+  }
+
+  //
+  // query driven by a pool in random order over a world larger than the caches
+  template <size_t D> void bench_prefetch(prefetch_world_type& world, size_t nb_matches)
+  {
+    auto& em  = world.get_entity_manager();
+    float sum = 0;
+    bench("for_each<shuffled,payload> prefetch=" + std::to_string(D), nb_matches, [&]()
+    {
+      em.for_each<shuffled<D>, payload>([&](prefetch_world_type::entity_type&, shuffled<D>& s, payload& p)
+      {
+        sum += s.v * p.v;
+      });
+      do_not_optimize(sum);
+    });
+  }
+
+  void run_prefetch(size_t nb_entities)
+  {
+    prefetch_world_type world;
+    auto& em = world.get_entity_manager();
+
+    std::vector<prefetch_world_type::entity_type*> entities;
+    for(size_t i = 0 ; i < nb_entities ; ++i)
+    {
+      entities.push_back(em.new_entity());
+      entities.back()->new_component<payload>((float)i);
+    }
+
+    // 1 entity out of 32 (sparse enough to walk the pool instead of the masks)
+    std::mt19937 gen(42);
+    std::shuffle(entities.begin(), entities.end(), gen);
+    entities.resize(nb_entities / 32);
+    for(prefetch_world_type::entity_type* e : entities)
+    {
+      e->new_component<shuffled<0>>(1.f);
+      e->new_component<shuffled<8>>(1.f);
+      e->new_component<shuffled<32>>(1.f);
+    }
+
+    bench_prefetch<0>(world, entities.size());
+    bench_prefetch<8>(world, entities.size());
+    bench_prefetch<32>(world, entities.size());
+
+    // same query once the pool follows the entity order
+    bench("sort_by_entity<shuffled> random pool", entities.size(), [&]()
+    {
+      em.sort_by_entity<shuffled<0>>();
+    }, 1);
+    bench("sort_by_entity<shuffled> sorted pool (budget)", entities.size(), [&]()
+    {
+      do_not_optimize(em.sort_by_entity<shuffled<0>>(64));
+    });
+
+    float sum = 0;
+    bench("for_each<shuffled,payload> sorted by entity", entities.size(), [&]()
+    {
+      em.for_each<shuffled<0>, payload>([&](prefetch_world_type::entity_type&, shuffled<0>& s, payload& p)
+      {
+        sum += s.v * p.v;
+      });
+      do_not_optimize(sum);
+    });
+  }
+}
+
+namespace
+{
+  //
+  // wave spawn : one call per entity and component against one batch (world destruction included)
+  template <class W, class A, class B> void run_spawn(const std::string& name, size_t nb_entities)
+  {
+    bench("new_entity + new_component " + name, nb_entities, [&]()
+    {
+      W world;
+      auto& em = world.get_entity_manager();
+      for(size_t i = 0 ; i < nb_entities ; ++i)
+      {
+        auto e = em.new_entity();
+        e->template new_component<A>((float)i);
+        e->template new_component<B>(1.f);
+      }
+      do_not_optimize(em.size());
+    });
+
+    bench("create_batch " + name, nb_entities, [&]()
+    {
+      W world;
+      auto& em = world.get_entity_manager();
+      em.template create_batch<A, B>(nb_entities, [](size_t i) { return A((float)i); }, B(1.f));
+      do_not_optimize(em.size());
+    });
+
+    bench("instantiate prefab " + name, nb_entities, [&]()
+    {
+      W world;
+      auto& em = world.get_entity_manager();
+      typename W::entity_manager_type::prefab unit;
+      unit.template set<A>(1.f);
+      unit.template set<B>(1.f);
+      em.instantiate(unit, nb_entities);
+      do_not_optimize(em.size());
+    });
+  }
+}
+
+int main()
+{
+  const size_t nb_entities = 1 << 19;
+  for(double density : {1., 0.1, 0.001})
+  {
+    run(nb_entities, density);
+  }
+
+  run_query<value<0>, value<1>, value<2>, value<3>>("segment", nb_entities);
+  run_query<packed_value<0>, packed_value<1>, packed_value<2>, packed_value<3>>("archetype", nb_entities);
+  run_integrate(nb_entities);
+  run_prefetch(1 << 22);
+  run_spawn<query_world_type, value<0>, value<1>>("segment", 1 << 14);
+  run_spawn<query_world_type, packed_value<0>, packed_value<1>>("archetype", 1 << 14);
+  return 0;
+}
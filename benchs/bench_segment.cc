@@ -0,0 +1,171 @@
+#include "bench.hpp"
+#include <entity_system/segment.hpp>
+
+#include <vector>
+#include <random>
+
+namespace
+{
+  struct data
+  {
+    data(uint32_t v)
+      : value(v)
+    {
+    }
+
+    uint32_t value;
+  };
+
+  //
+  // previous iteration : walk each position and test it with has()
+  template <class Seg> typename Seg::id_type legacy_next(const Seg& dyn_segment, typename Seg::id_type pos, typename Seg::id_type end, size_t nb_segments)
+  {
+    typedef typename Seg::segment_type segment_type;
+    if(pos != end)
+    {
+      do
+      {
+        do
+        {
+          ++pos.seg_id;
+        } while(pos.seg_id < segment_type::max_pos() && !dyn_segment.has(pos));
+
+        if(pos.seg_id == segment_type::max_pos())
+        {
+          pos.seg_id = 0;
+          if(nb_segments == pos.seg_nb + 1u)
+          {
+            pos = end;
+            break;
+          }
+          else
+          {
+            ++pos.seg_nb;
+          }
+        }
+      } while(!dyn_segment.has(pos));
+    }
+    return pos;
+  }
+
+  template <class Seg> uint64_t legacy_sum(const Seg& dyn_segment, size_t nb_segments)
+  {
+    typedef typename Seg::id_type      id_type;
+    typedef typename Seg::segment_type segment_type;
+
+    uint64_t sum = 0;
+    id_type  end(segment_type::max_pos(), nb_segments - 1);
+    for(id_type pos = legacy_next(dyn_segment, id_type(0), end, nb_segments) ; pos != end ; pos = legacy_next(dyn_segment, pos, end, nb_segments))
+    {
+      sum += dyn_segment.get(pos)->value;
+    }
+    return sum;
+  }
+
+  template <class Seg> uint64_t new_sum(Seg& dyn_segment)
+  {
+    uint64_t sum = 0;
+    for(data* d : dyn_segment)
+    {
+      sum += d->value;
+    }
+    return sum;
+  }
+
+  template <size_t S> void run(size_t nb_slots, double density)
+  {
+    typedef entity_system::dynamic_segment<data, S> segment_type;
+    typedef typename segment_type::id_type          id_type;
+
+    segment_type          segment;
+    std::vector<id_type>  ids;
+    ids.reserve(nb_slots);
+    for(size_t i = 0 ; i < nb_slots ; ++i)
+    {
+      ids.push_back(segment.acquire((uint32_t)i).second);
+    }
+
+    std::mt19937 gen(42);
+    std::bernoulli_distribution keep(density);
+    size_t nb_live = 0;
+    for(id_type id : ids)
+    {
+      if(keep(gen))
+      {
+        ++nb_live;
+      }
+      else
+      {
+        segment.release(id);
+      }
+    }
+
+    std::string suffix = " S=" + std::to_string(S) + " density=" + std::to_string(density).substr(0, 5);
+    uint64_t ref = 0;
+    uint64_t val = 0;
+    bench("legacy has() scan" + suffix, nb_live, [&]() { ref = legacy_sum(segment, (nb_slots + S - 1) / S); do_not_optimize(ref); });
+    bench("bit scan" + suffix,          nb_live, [&]() { val = new_sum(segment); do_not_optimize(val); });
+    if(ref != val)
+    {
+      std::cerr << "mismatch " << ref << " != " << val << std::endl;
+    }
+  }
+
+  template <size_t S> void run_churn(size_t nb_slots, size_t nb_ops)
+  {
+    typedef entity_system::dynamic_segment<data, S> segment_type;
+    typedef typename segment_type::id_type          id_type;
+
+    segment_type          segment;
+    std::vector<id_type>  ids;
+    ids.reserve(nb_slots);
+    bench("fill S=" + std::to_string(S), nb_slots, [&]()
+    {
+      segment.clear();
+      ids.clear();
+      for(size_t i = 0 ; i < nb_slots ; ++i)
+      {
+        ids.push_back(segment.acquire((uint32_t)i).second);
+      }
+    }, 1);
+
+    segment_type reserved;
+    bench("fill reserved S=" + std::to_string(S), nb_slots, [&]()
+    {
+      reserved.reserve(nb_slots);
+      for(size_t i = 0 ; i < nb_slots ; ++i)
+      {
+        reserved.acquire((uint32_t)i);
+      }
+    }, 1);
+
+    // release/acquire at random position on an almost full pool
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<size_t> pick(0, nb_slots - 1);
+    bench("churn release+acquire S=" + std::to_string(S), nb_ops, [&]()
+    {
+      for(size_t i = 0 ; i < nb_ops ; ++i)
+      {
+        size_t p = pick(gen);
+        segment.release(ids[p]);
+        ids[p] = segment.acquire((uint32_t)p).second;
+      }
+    });
+  }
+}
+
+int main()
+{
+  const size_t nb_slots = 1 << 22;
+  for(double density : {1., 0.5, 0.1, 0.01, 0.001})
+  {
+    run<8>(nb_slots, density);
+    run<64>(nb_slots, density);
+    run<1024>(nb_slots, density);
+  }
+
+  run_churn<8>(nb_slots, 1 << 20);
+  run_churn<64>(nb_slots, 1 << 20);
+  run_churn<1024>(nb_slots, 1 << 20);
+  return 0;
+}
@@ -0,0 +1,635 @@
+#ifndef ENTITY_SYSTEM_ARCHETYPE_HPP
+# define ENTITY_SYSTEM_ARCHETYPE_HPP
+
+# include <entity_system/forwards.hpp>
+# include <entity_system/memory_resource.hpp>
+# include <entity_system/segment.hpp>
+
+# include <array>
+# include <bitset>
+# include <vector>
+# include <tuple>
+# include <unordered_map>
+# include <limits>
+
+namespace entity_system
+{
+  namespace detail
+  {
+    /**
+     * type erased operations on a column
+     */
+    struct column_ops
+    {
+      size_t size;
+      size_t alignment;
+      void (*relocate)(void* from, void* to);
+      void (*destroy)(void* p);
+    };
+
+    template <class T> struct column_ops_of
+    {
+      static const column_ops* get()
+      {
+        static const column_ops ret = {sizeof(T), alignof(T), &relocate_, &destroy_};
+        return &ret;
+      }
+
+      static void relocate_(void* from, void* to)
+      {
+        entity_system::relocate<T>::process(*(T*)from, to);
+      }
+
+      static void destroy_(void* p)
+      {
+        ((T*)p)->~T();
+      }
+    };
+
+    // not stored in archetypes
+    template <> struct column_ops_of<void>
+    {
+      static const column_ops* get()
+      {
+        return nullptr;
+      }
+    };
+  }
+
+  template <class Columns> class archetype_store;
+
+  /**
+   * entities grouped by set of components (archetype), each archetype stores its rows
+   * in fixed size chunks : one column of entity ids and one column per component
+   *
+   * Columns has one type per component of the world, void for components stored elsewhere.
+   * Rows are packed : removing one moves the last row of the archetype in its place.
+   */
+  template <class ... Columns> class archetype_store<std::tuple<Columns...>>
+  {
+    public:
+      static constexpr size_t nb_columns = sizeof...(Columns);
+
+      typedef std::bitset<nb_columns> mask_type;
+      typedef uint32_t                archetype_id_type;
+      typedef uint32_t                row_type;
+
+      static constexpr size_t chunk_bytes()
+      {
+        return 16 * 1024;
+      }
+
+      static constexpr row_type npos()
+      {
+        return std::numeric_limits<row_type>::max();
+      }
+
+      class archetype
+      {
+        public:
+          friend archetype_store;
+
+          archetype(memory_resource* resource, const mask_type& mask)
+            : mask_(mask)
+            , size_(0)
+            , shift_(0)
+            , alignment_(alignof(entity_id_type))
+            , columns_(columns_allocator_type(resource))
+            , chunks_(chunk_allocator_type(resource))
+          {
+            offsets_.fill(0);
+            add_edges_.fill(0);
+            remove_edges_.fill(0);
+
+            size_t row_bytes = sizeof(entity_id_type);
+            size_t padding   = 0;
+            for(size_t c = 0 ; c < nb_columns ; ++c)
+            {
+              if(mask_[c])
+              {
+                columns_.push_back(c);
+                row_bytes += ops_(c)->size;
+                padding   += ops_(c)->alignment;
+                alignment_ = std::max(alignment_, ops_(c)->alignment);
+              }
+            }
+
+            // power of 2 rows per chunk, at least one
+            size_t capacity = (chunk_bytes() > padding ? (chunk_bytes() - padding) / row_bytes : 0);
+            while(((size_t)2 << shift_) <= capacity)
+            {
+              ++shift_;
+            }
+
+            size_t offset = this->capacity() * sizeof(entity_id_type);
+            for(size_t c : columns_)
+            {
+              offset      = (offset + ops_(c)->alignment - 1) & ~(ops_(c)->alignment - 1);
+              offsets_[c] = offset;
+              offset     += this->capacity() * ops_(c)->size;
+            }
+            bytes_ = offset;
+          }
+
+          archetype(archetype&&) = default;
+
+          const mask_type& mask() const
+          {
+            return mask_;
+          }
+
+          bool has(size_t column) const
+          {
+            return mask_[column];
+          }
+
+          /**
+           * number of rows
+           */
+          size_t size() const
+          {
+            return size_;
+          }
+
+          /**
+           * rows per chunk
+           */
+          size_t capacity() const
+          {
+            return (size_t)1 << shift_;
+          }
+
+          size_t nb_chunks() const
+          {
+            return (size_ + capacity() - 1) >> shift_;
+          }
+
+          /**
+           * number of rows in chunk
+           */
+          size_t chunk_size(size_t chunk) const
+          {
+            return std::min(capacity(), size_ - (chunk << shift_));
+          }
+
+          entity_id_type* ids(size_t chunk) const
+          {
+            return (entity_id_type*)chunks_[chunk];
+          }
+
+          void* column(size_t chunk, size_t column) const
+          {
+            return chunks_[chunk] + offsets_[column];
+          }
+
+          template <class T> T* column(size_t chunk, size_t column) const
+          {
+            return (T*)(chunks_[chunk] + offsets_[column]);
+          }
+
+          void* at(row_type row, size_t column) const
+          {
+            return chunks_[row >> shift_] + offsets_[column] + (row & (capacity() - 1)) * ops_(column)->size;
+          }
+
+          template <class T> T* at(row_type row, size_t column) const
+          {
+            return (T*)(chunks_[row >> shift_] + offsets_[column]) + (row & (capacity() - 1));
+          }
+
+          entity_id_type& id(row_type row) const
+          {
+            return ids(row >> shift_)[row & (capacity() - 1)];
+          }
+
+        private:
+          typedef resource_allocator<size_t>                    columns_allocator_type;
+          typedef std::vector<size_t, columns_allocator_type>   columns_type;
+          typedef resource_allocator<uint8_t*>                  chunk_allocator_type;
+          typedef std::vector<uint8_t*, chunk_allocator_type>   chunks_type;
+
+          mask_type                                   mask_;
+          size_t                                      size_;
+          size_t                                      shift_;
+          size_t                                      bytes_;
+          size_t                                      alignment_;
+          columns_type                                columns_;
+          std::array<size_t, nb_columns>              offsets_;
+          std::array<archetype_id_type, nb_columns>   add_edges_;
+          std::array<archetype_id_type, nb_columns>   remove_edges_;
+          chunks_type                                 chunks_;
+      };
+
+      archetype_store(memory_resource* resource = default_resource())
+        : resource_(resource)
+        , archetypes_(archetype_allocator_type(resource))
+        , index_(0, std::hash<mask_type>(), std::equal_to<mask_type>(), index_allocator_type(resource))
+        , locations_(location_allocator_type(resource))
+      {
+        sizes_.fill(0);
+        // archetype 0 : no component, never has rows
+        archetypes_.emplace_back(resource_, mask_type());
+        index_[mask_type()] = 0;
+      }
+
+      archetype_store(const archetype_store&) = delete;
+      archetype_store& operator=(const archetype_store&) = delete;
+
+      ~archetype_store()
+      {
+        for(archetype& a : archetypes_)
+        {
+          for(row_type row = 0 ; row < a.size_ ; ++row)
+          {
+            destroy_row_(a, row);
+          }
+          a.size_ = 0;
+          free_chunks_(a, 0);
+        }
+      }
+
+      /**
+       * build column I of entity id with args, the entity moves to its new archetype
+       */
+      template <size_t I, class ... ARGS> typename std::tuple_element<I, std::tuple<Columns...>>::type* add(entity_id_type id, ARGS && ... args)
+      {
+        typedef typename std::tuple_element<I, std::tuple<Columns...>>::type type;
+
+        if(id >= locations_.size())
+        {
+          locations_.resize(id + 1, location_type{0, npos()});
+        }
+
+        location_type from = locations_[id];
+        if(archetypes_[from.archetype].has(I))
+        {
+          return nullptr;
+        }
+
+        archetype_id_type to   = edge_(from.archetype, I, true);
+        archetype&        dst  = archetypes_[to];
+        row_type          row  = push_(dst, id);
+
+        // build the new one before moving the others : args may refer to one of them
+        type* ret = new(dst.at(row, I)) type(std::forward<ARGS>(args)...);
+        ++sizes_[I];
+        if(from.archetype)
+        {
+          move_row_(archetypes_[from.archetype], from.row, &dst, row);
+        }
+        locations_[id] = location_type{to, row};
+        return ret;
+      }
+
+      /**
+       * archetype with the columns of mask (built if needed)
+       */
+      archetype_id_type archetype_of(const mask_type& mask)
+      {
+        archetype_id_type ret = 0;
+        for(size_t column = 0 ; column < nb_columns ; ++column)
+        {
+          if(mask[column])
+          {
+            ret = edge_(ret, column, true);
+          }
+        }
+        return ret;
+      }
+
+      /**
+       * put entity id (without any column) in a new row of archetype a (not 0),
+       * each of its columns must then be built with build<I>
+       */
+      void add_row(entity_id_type id, archetype_id_type a)
+      {
+        if(id >= locations_.size())
+        {
+          locations_.resize(id + 1, location_type{0, npos()});
+        }
+        locations_[id] = location_type{a, push_(archetypes_[a], id)};
+      }
+
+      /**
+       * build column I of entity id with args in the row given by add_row
+       */
+      template <size_t I, class ... ARGS> typename std::tuple_element<I, std::tuple<Columns...>>::type* build(entity_id_type id, ARGS && ... args)
+      {
+        typedef typename std::tuple_element<I, std::tuple<Columns...>>::type type;
+
+        const location_type& location = locations_[id];
+        type* ret = new(archetypes_[location.archetype].template at<type>(location.row, I)) type(std::forward<ARGS>(args)...);
+        ++sizes_[I];
+        return ret;
+      }
+
+      /**
+       * destroy column of entity id, the entity moves to its new archetype
+       */
+      void remove(entity_id_type id, size_t column)
+      {
+        if(id < locations_.size() && archetypes_[locations_[id].archetype].has(column))
+        {
+          location_type     from = locations_[id];
+          archetype_id_type to   = edge_(from.archetype, column, false);
+          archetype*        dst  = (to ? &archetypes_[to] : nullptr);
+          row_type          row  = (dst ? push_(*dst, id) : npos());
+
+          move_row_(archetypes_[from.archetype], from.row, dst, row);
+          locations_[id] = location_type{to, row};
+        }
+      }
+
+      /**
+       * destroy all columns of entity id
+       */
+      void remove_all(entity_id_type id)
+      {
+        if(id < locations_.size() && locations_[id].archetype)
+        {
+          move_row_(archetypes_[locations_[id].archetype], locations_[id].row, nullptr, npos());
+          locations_[id] = location_type{0, npos()};
+        }
+      }
+
+      template <size_t I> typename std::tuple_element<I, std::tuple<Columns...>>::type* get(entity_id_type id) const
+      {
+        typedef typename std::tuple_element<I, std::tuple<Columns...>>::type type;
+
+        type* ret = nullptr;
+        if(id < locations_.size())
+        {
+          const location_type& location = locations_[id];
+          const archetype&     a        = archetypes_[location.archetype];
+          if(a.has(I))
+          {
+            ret = a.template at<type>(location.row, I);
+          }
+        }
+        return ret;
+      }
+
+      /**
+       * column I of entity id, the entity must have it (no check)
+       */
+      template <size_t I> typename std::tuple_element<I, std::tuple<Columns...>>::type* at(entity_id_type id) const
+      {
+        const location_type& location = locations_[id];
+        return archetypes_[location.archetype].template at<typename std::tuple_element<I, std::tuple<Columns...>>::type>(location.row, I);
+      }
+
+      /**
+       * call functor(archetype&) for each non empty archetype having all columns of mask
+       */
+      template <class F> void for_each(const mask_type& mask, F && functor)
+      {
+        for_each(mask, mask_type(), functor);
+      }
+
+      /**
+       * same for archetypes having no column of exclude
+       */
+      template <class F> void for_each(const mask_type& mask, const mask_type& exclude, F && functor)
+      {
+        // functor may add archetypes
+        for(size_t i = 0 ; i < archetypes_.size() ; ++i)
+        {
+          archetype& a = archetypes_[i];
+          if(a.size_ && (a.mask_ & mask) == mask && (a.mask_ & exclude).none())
+          {
+            functor(a);
+          }
+        }
+      }
+
+      /**
+       * call functor(archetype&, row_type) for each row of the archetypes of for_each(mask, exclude), last rows first
+       * (functor may remove the current row or add archetypes : the archetype is fetched again after each call)
+       */
+      template <class F> void for_each_row(const mask_type& mask, const mask_type& exclude, F && functor)
+      {
+        for(size_t i = 0 ; i < archetypes_.size() ; ++i)
+        {
+          if(archetypes_[i].size_ && (archetypes_[i].mask_ & mask) == mask && (archetypes_[i].mask_ & exclude).none())
+          {
+            for(size_t row = archetypes_[i].size_ ; row-- > 0 ;)
+            {
+              functor(archetypes_[i], (row_type)row);
+              row = std::min(row, archetypes_[i].size_);
+            }
+          }
+        }
+      }
+
+      /**
+       * call functor(entity_id_type) for each entity having column, last rows first
+       * (functor may remove the column of the current entity)
+       */
+      template <class F> void for_each_id(size_t column, F && functor)
+      {
+        for_each_id(column, functor, 0, [](entity_id_type) {});
+      }
+
+      /**
+       * same, lookahead(entity_id_type) is called with the id distance rows ahead in the same archetype
+       */
+      template <class F, class L> void for_each_id(size_t column, F && functor, size_t distance, L && lookahead)
+      {
+        for(size_t i = 0 ; i < archetypes_.size() ; ++i)
+        {
+          if(archetypes_[i].has(column))
+          {
+            for(size_t row = archetypes_[i].size_ ; row-- > 0 ;)
+            {
+              if(distance && row >= distance)
+              {
+                lookahead(archetypes_[i].id((row_type)(row - distance)));
+              }
+              functor(archetypes_[i].id((row_type)row));
+              row = std::min(row, archetypes_[i].size_);
+            }
+          }
+        }
+      }
+
+      /**
+       * rank of the row of id in the order of for_each (archetype then row)
+       */
+      uint64_t position(entity_id_type id) const
+      {
+        return ((uint64_t)locations_[id].archetype << 32) | locations_[id].row;
+      }
+
+      /**
+       * prefetch the location of id
+       */
+      void prefetch(entity_id_type id) const
+      {
+        if(id < locations_.size())
+        {
+          detail::prefetch(&locations_[id]);
+        }
+      }
+
+      /**
+       * number of entities having column
+       */
+      size_t size(size_t column) const
+      {
+        return sizes_[column];
+      }
+
+      size_t nb_archetypes() const
+      {
+        return archetypes_.size();
+      }
+
+      void reserve_locations(entity_id_type max_entity_id)
+      {
+        locations_.reserve(max_entity_id + 1);
+      }
+
+      /**
+       * give back chunks without rows
+       */
+      void shrink_to_fit()
+      {
+        for(archetype& a : archetypes_)
+        {
+          free_chunks_(a, a.nb_chunks());
+          a.chunks_.shrink_to_fit();
+        }
+        while(!locations_.empty() && !locations_.back().archetype)
+        {
+          locations_.pop_back();
+        }
+        locations_.shrink_to_fit();
+      }
+
+    protected:
+      struct location_type
+      {
+        archetype_id_type archetype;
+        row_type          row;
+      };
+
+      typedef resource_allocator<archetype>                                                   archetype_allocator_type;
+      typedef std::vector<archetype, archetype_allocator_type>                                archetypes_type;
+      typedef resource_allocator<std::pair<const mask_type, archetype_id_type>>              index_allocator_type;
+      typedef std::unordered_map<mask_type, archetype_id_type, std::hash<mask_type>, std::equal_to<mask_type>, index_allocator_type> index_type;
+      typedef resource_allocator<location_type>                                               location_allocator_type;
+      typedef std::vector<location_type, location_allocator_type>                             locations_type;
+
+      static const detail::column_ops* ops_(size_t column)
+      {
+        static const detail::column_ops* ops[] = {detail::column_ops_of<Columns>::get()...};
+        return ops[column];
+      }
+
+      /**
+       * archetype reached from archetype id by adding (or removing) column, cached on the archetype
+       */
+      archetype_id_type edge_(archetype_id_type id, size_t column, bool add)
+      {
+        archetype_id_type& edge = (add ? archetypes_[id].add_edges_[column] : archetypes_[id].remove_edges_[column]);
+        if(!edge && (add || archetypes_[id].mask_.count() > 1))
+        {
+          mask_type mask = archetypes_[id].mask_;
+          mask[column]   = add;
+
+          typename index_type::iterator it = index_.find(mask);
+          archetype_id_type ret = 0;
+          if(it == index_.end())
+          {
+            ret = (archetype_id_type)archetypes_.size();
+            archetypes_.emplace_back(resource_, mask);
+            index_[mask] = ret;
+          }
+          else
+          {
+            ret = it->second;
+          }
+
+          // archetypes_ may have been reallocated
+          (add ? archetypes_[id].add_edges_[column] : archetypes_[id].remove_edges_[column]) = ret;
+          return ret;
+        }
+        return edge;
+      }
+
+      row_type push_(archetype& a, entity_id_type id)
+      {
+        if(a.size_ == (a.chunks_.size() << a.shift_))
+        {
+          a.chunks_.push_back((uint8_t*)resource_->allocate(a.bytes_, a.alignment_));
+        }
+        row_type row = (row_type)a.size_++;
+        a.id(row)    = id;
+        return row;
+      }
+
+      void destroy_row_(archetype& a, row_type row)
+      {
+        for(size_t c : a.columns_)
+        {
+          ops_(c)->destroy(a.at(row, c));
+        }
+      }
+
+      /**
+       * relocate columns of row of src into row of dst (destroy the ones dst has not) and remove row from src
+       */
+      void move_row_(archetype& src, row_type row, archetype* dst, row_type dst_row)
+      {
+        for(size_t c : src.columns_)
+        {
+          if(dst && dst->has(c))
+          {
+            ops_(c)->relocate(src.at(row, c), dst->at(dst_row, c));
+          }
+          else
+          {
+            ops_(c)->destroy(src.at(row, c));
+            --sizes_[c];
+          }
+        }
+
+        // swap and pop
+        row_type last = (row_type)(src.size_ - 1);
+        if(row != last)
+        {
+          for(size_t c : src.columns_)
+          {
+            ops_(c)->relocate(src.at(last, c), src.at(row, c));
+          }
+          src.id(row) = src.id(last);
+          locations_[src.id(row)].row = row;
+        }
+        --src.size_;
+
+        // keep one spare chunk
+        if(src.chunks_.size() > src.nb_chunks() + 1)
+        {
+          free_chunks_(src, src.nb_chunks() + 1);
+        }
+      }
+
+      void free_chunks_(archetype& a, size_t keep)
+      {
+        while(a.chunks_.size() > keep)
+        {
+          resource_->deallocate(a.chunks_.back(), a.bytes_, a.alignment_);
+          a.chunks_.pop_back();
+        }
+      }
+
+    private:
+      memory_resource*               resource_;
+      archetypes_type                archetypes_;
+      index_type                     index_;
+      locations_type                 locations_;
+      std::array<size_t, nb_columns> sizes_;
+  };
+}
+
+#endif
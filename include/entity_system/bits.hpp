@@ -0,0 +1,626 @@
+#ifndef ENTITY_SYSTEM_BITS_HPP
+# define ENTITY_SYSTEM_BITS_HPP
+
+# include <entity_system/forwards.hpp>
+# include <entity_system/memory_resource.hpp>
+
+# include <vector>
+# include <algorithm>
+# include <initializer_list>
+
+# if defined(_MSC_VER) && !defined(__clang__)
+#  include <intrin.h>
+# endif
+
+# if defined(__AVX2__)
+#  include <immintrin.h>
+#  define ENTITY_SYSTEM_HAS_AVX2 1
+# elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  include <emmintrin.h>
+#  define ENTITY_SYSTEM_HAS_SSE2 1
+# endif
+
+namespace entity_system
+{
+  namespace detail
+  {
+    /**
+     * count trailing zeros of a non null value
+     */
+    inline unsigned int ctz(uint64_t value)
+    {
+# if defined(__GNUC__) || defined(__clang__)
+      return __builtin_ctzll(value);
+# elif defined(_MSC_VER) && defined(_M_X64)
+      unsigned long ret;
+      _BitScanForward64(&ret, value);
+      return ret;
+# else
+      static const uint8_t nibblebits[] = {4, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0};
+      unsigned int ret = 0;
+      for(;(value & 0x0f) == 0; ret += 4)
+      {
+        value >>= 4;
+      }
+      return ret + nibblebits[value & 0x0f];
+# endif
+    }
+
+    /**
+     * count set bits
+     */
+    inline unsigned int popcount(uint64_t value)
+    {
+# if defined(__GNUC__) || defined(__clang__)
+      return __builtin_popcountll(value);
+# elif defined(_MSC_VER) && defined(_M_X64)
+      return (unsigned int)__popcnt64(value);
+# else
+      static const uint8_t nibblebits[] = {0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4};
+      unsigned int ret = 0;
+      for(;value != 0; value >>= 4)
+      {
+        ret += nibblebits[value & 0x0f];
+      }
+      return ret;
+# endif
+    }
+
+    /**
+     * hint to bring the cache line of p in the cache (never faults)
+     */
+    inline void prefetch(const void* p)
+    {
+# if defined(__GNUC__) || defined(__clang__)
+      __builtin_prefetch(p);
+# elif defined(ENTITY_SYSTEM_HAS_AVX2) || defined(ENTITY_SYSTEM_HAS_SSE2)
+      _mm_prefetch((const char*)p, _MM_HINT_T0);
+# else
+      (void)p;
+# endif
+    }
+
+    /**
+     * bit i of the result : (words[i] & query) == expected, for 64 consecutive words
+     */
+    inline uint64_t match_64(const uint64_t* words, uint64_t query, uint64_t expected)
+    {
+      uint64_t ret = 0;
+# if defined(ENTITY_SYSTEM_HAS_AVX2)
+      __m256i q = _mm256_set1_epi64x((long long)query);
+      __m256i x = _mm256_set1_epi64x((long long)expected);
+      for(unsigned int i = 0 ; i < 64 ; i += 4)
+      {
+        __m256i v  = _mm256_loadu_si256((const __m256i*)(words + i));
+        __m256i eq = _mm256_cmpeq_epi64(_mm256_and_si256(v, q), x);
+        ret |= (uint64_t)_mm256_movemask_pd(_mm256_castsi256_pd(eq)) << i;
+      }
+# elif defined(ENTITY_SYSTEM_HAS_SSE2)
+      // no 64 bits compare in sse2 : both 32 bits halves must be equal
+      __m128i q = _mm_set1_epi64x((long long)query);
+      __m128i x = _mm_set1_epi64x((long long)expected);
+      for(unsigned int i = 0 ; i < 64 ; i += 2)
+      {
+        __m128i v    = _mm_loadu_si128((const __m128i*)(words + i));
+        __m128i eq32 = _mm_cmpeq_epi32(_mm_and_si128(v, q), x);
+        __m128i eq   = _mm_and_si128(eq32, _mm_shuffle_epi32(eq32, _MM_SHUFFLE(2, 3, 0, 1)));
+        ret |= (uint64_t)_mm_movemask_pd(_mm_castsi128_pd(eq)) << i;
+      }
+# else
+      for(unsigned int i = 0 ; i < 64 ; ++i)
+      {
+        ret |= (uint64_t)((words[i] & query) == expected) << i;
+      }
+# endif
+      return ret;
+    }
+
+    /**
+     * bit i of the result : (words[i] & query) == query, for 64 consecutive words
+     */
+    inline uint64_t match_64(const uint64_t* words, uint64_t query)
+    {
+      return match_64(words, query, query);
+    }
+
+    /**
+     * number of 64 bits words to store bits (at least one)
+     */
+    constexpr size_t nb_words(size_t bits)
+    {
+      return (bits ? (bits + 63) / 64 : 1);
+    }
+
+    /**
+     * fixed size set of bits as 64 bits words, usable in constant expressions
+     */
+    template <size_t W> struct mask_words
+    {
+      uint64_t words[W];
+    };
+
+    template <size_t W> constexpr mask_words<W> make_mask_words(std::initializer_list<size_t> bits)
+    {
+      mask_words<W> ret = {};
+      for(size_t bit : bits)
+      {
+        ret.words[bit / 64] |= (uint64_t)1 << (bit % 64);
+      }
+      return ret;
+    }
+
+    /**
+     * W words of bits per index, stored word by word (one dense column per word)
+     * so that a query only streams the words it tests
+     */
+    template <size_t W> class mask_columns
+    {
+      public:
+        typedef mask_words<W> query_type;
+
+        mask_columns(memory_resource* resource = default_resource())
+          : columns_(column_allocator_type(resource))
+          , size_(0)
+        {
+          for(size_t w = 0 ; w < W ; ++w)
+          {
+            columns_.emplace_back(columns_.get_allocator());
+          }
+        }
+
+        size_t size() const
+        {
+          return size_;
+        }
+
+        /**
+         * new indexes have no bit set, padded to a multiple of 64
+         */
+        void resize(size_t n)
+        {
+          size_ = n;
+          for(column_type& column : columns_)
+          {
+            column.resize((n + 63) & ~(size_t)63, 0);
+          }
+        }
+
+        void reserve(size_t n)
+        {
+          for(column_type& column : columns_)
+          {
+            column.reserve((n + 63) & ~(size_t)63);
+          }
+        }
+
+        void shrink_to_fit()
+        {
+          for(column_type& column : columns_)
+          {
+            column.shrink_to_fit();
+          }
+        }
+
+        void set(size_t index, size_t bit, bool value)
+        {
+          uint64_t& word = columns_[bit / 64][index];
+          word = (value ? word | mask_(bit) : word & ~mask_(bit));
+        }
+
+        /**
+         * set all bits of query
+         */
+        void set(size_t index, const query_type& query)
+        {
+          for(size_t w = 0 ; w < W ; ++w)
+          {
+            columns_[w][index] |= query.words[w];
+          }
+        }
+
+        /**
+         * reset all bits of query
+         */
+        void reset(size_t index, const query_type& query)
+        {
+          for(size_t w = 0 ; w < W ; ++w)
+          {
+            columns_[w][index] &= ~query.words[w];
+          }
+        }
+
+        /**
+         * prefetch the words of index
+         */
+        void prefetch(size_t index) const
+        {
+          for(const column_type& column : columns_)
+          {
+            detail::prefetch(column.data() + index);
+          }
+        }
+
+        void clear(size_t index)
+        {
+          for(column_type& column : columns_)
+          {
+            column[index] = 0;
+          }
+        }
+
+        /**
+         * all bits of query are set on index
+         */
+        bool test(size_t index, const query_type& query) const
+        {
+          return test(index, query, query_type());
+        }
+
+        /**
+         * all bits of query and none of exclude are set on index
+         */
+        bool test(size_t index, const query_type& query, const query_type& exclude) const
+        {
+          for(size_t w = 0 ; w < W ; ++w)
+          {
+            if((columns_[w][index] & (query.words[w] | exclude.words[w])) != query.words[w])
+            {
+              return false;
+            }
+          }
+          return true;
+        }
+
+        /**
+         * call functor(index) for each index with all bits of query (not empty), 64 indexes are filtered at once
+         * (functor may change bits or resize : each index is tested again before the call)
+         */
+        template <class F> void for_each_match(const query_type& query, F && functor) const
+        {
+          for_each_match(query, query_type(), functor);
+        }
+
+        /**
+         * same with none of the bits of exclude
+         */
+        template <class F> void for_each_match(const query_type& query, const query_type& exclude, F && functor) const
+        {
+          for(size_t block = 0 ; block * 64 < size_ ; ++block)
+          {
+            uint64_t bits = (uint64_t)-1;
+            for(size_t w = 0 ; w < W && bits ; ++w)
+            {
+              if(query.words[w] | exclude.words[w])
+              {
+                bits &= match_64(columns_[w].data() + block * 64, query.words[w] | exclude.words[w], query.words[w]);
+              }
+            }
+
+            while(bits)
+            {
+              size_t index = block * 64 + ctz(bits);
+              bits &= bits - 1;
+              if(index < size_ && test(index, query, exclude))
+              {
+                functor(index);
+              }
+            }
+          }
+        }
+
+      protected:
+        typedef std::vector<uint64_t, resource_allocator<uint64_t>> column_type;
+        typedef resource_allocator<column_type>                      column_allocator_type;
+
+        static uint64_t mask_(size_t bit)
+        {
+          return (uint64_t)1 << (bit % 64);
+        }
+
+      private:
+        std::vector<column_type, column_allocator_type> columns_;
+        size_t                                          size_;
+    };
+
+    /**
+     * map of keys 0 .. n to values, stored in pages of P values allocated when a key of the page is set
+     * and freed when none is left, unless kept by reserve_pages (a missing key reads as Invalid)
+     */
+    template <class V, V Invalid, size_t P = 1024> class paged_map
+    {
+      public:
+        static_assert((P & (P - 1)) == 0, "page size must be a power of 2");
+
+        paged_map(memory_resource* resource = default_resource())
+          : resource_(resource)
+          , pages_(page_allocator_type(resource))
+          , nb_pages_(0)
+          , reserved_(0)
+        {
+        }
+
+        paged_map(const paged_map&) = delete;
+        paged_map& operator=(const paged_map&) = delete;
+
+        ~paged_map()
+        {
+          for(page_type* page : pages_)
+          {
+            free_(page);
+          }
+        }
+
+        V get(size_t key) const
+        {
+          size_t nb = key / P;
+          return (nb < pages_.size() && pages_[nb] ? pages_[nb]->values[key % P] : Invalid);
+        }
+
+        /**
+         * value of a key which is set (no check)
+         */
+        V& at(size_t key)
+        {
+          return pages_[key / P]->values[key % P];
+        }
+
+        const V& at(size_t key) const
+        {
+          return pages_[key / P]->values[key % P];
+        }
+
+        /**
+         * location of the value of key, nullptr if its page is not allocated
+         */
+        const V* find(size_t key) const
+        {
+          size_t nb = key / P;
+          return (nb < pages_.size() && pages_[nb] ? &pages_[nb]->values[key % P] : nullptr);
+        }
+
+        void set(size_t key, V value)
+        {
+          size_t nb = key / P;
+          if(value == Invalid)
+          {
+            if(nb < pages_.size() && pages_[nb] && pages_[nb]->values[key % P] != Invalid)
+            {
+              pages_[nb]->values[key % P] = Invalid;
+              if(!--pages_[nb]->count && nb >= reserved_)
+              {
+                free_(pages_[nb]);
+                pages_[nb] = nullptr;
+              }
+            }
+            return;
+          }
+
+          if(nb >= pages_.size())
+          {
+            pages_.resize(nb + 1, nullptr);
+          }
+          build_(nb);
+          V& slot = pages_[nb]->values[key % P];
+          pages_[nb]->count += (slot == Invalid);
+          slot = value;
+        }
+
+        /**
+         * room for the page table of keys 0 .. n - 1 (pages are still allocated on demand)
+         */
+        void reserve(size_t n)
+        {
+          pages_.reserve((n + P - 1) / P);
+        }
+
+        /**
+         * allocate the pages of keys 0 .. n - 1, they are kept when emptied (until shrink_to_fit)
+         */
+        void reserve_pages(size_t n)
+        {
+          size_t count = (n + P - 1) / P;
+          if(count > pages_.size())
+          {
+            pages_.resize(count, nullptr);
+          }
+          for(size_t nb = 0 ; nb < count ; ++nb)
+          {
+            build_(nb);
+          }
+          reserved_ = std::max(reserved_, count);
+        }
+
+        /**
+         * free empty pages, reserved ones too
+         */
+        void shrink_to_fit()
+        {
+          reserved_ = 0;
+          for(page_type*& page : pages_)
+          {
+            if(page && !page->count)
+            {
+              free_(page);
+              page = nullptr;
+            }
+          }
+          while(!pages_.empty() && !pages_.back())
+          {
+            pages_.pop_back();
+          }
+          pages_.shrink_to_fit();
+        }
+
+        size_t nb_pages() const
+        {
+          return nb_pages_;
+        }
+
+        static constexpr size_t page_size()
+        {
+          return P;
+        }
+
+      protected:
+        struct page_type
+        {
+          V      values[P];
+          size_t count;
+        };
+
+        typedef resource_allocator<page_type*>                 page_allocator_type;
+        typedef std::vector<page_type*, page_allocator_type>   pages_type;
+
+        void build_(size_t nb)
+        {
+          if(!pages_[nb])
+          {
+            pages_[nb] = new(resource_->allocate(sizeof(page_type), alignof(page_type))) page_type;
+            std::fill(pages_[nb]->values, pages_[nb]->values + P, Invalid);
+            pages_[nb]->count = 0;
+            ++nb_pages_;
+          }
+        }
+
+        void free_(page_type* page)
+        {
+          if(page)
+          {
+            page->~page_type();
+            resource_->deallocate(page, sizeof(page_type), alignof(page_type));
+            --nb_pages_;
+          }
+        }
+
+      private:
+        memory_resource* resource_;
+        pages_type       pages_;
+        size_t           nb_pages_;
+        size_t           reserved_; // pages kept even when empty
+    };
+
+    /**
+     * bitmap with one summary level per 64 bits, find_first/set/reset are O(log64(n))
+     */
+    class hierarchical_bitmap
+    {
+      public:
+        static constexpr size_t npos()
+        {
+          return (size_t)-1;
+        }
+
+        hierarchical_bitmap(memory_resource* resource = default_resource())
+          : levels_(level_allocator_type(resource))
+          , size_(0)
+        {
+          resize(0);
+        }
+
+        size_t size() const
+        {
+          return size_;
+        }
+
+        void resize(size_t n)
+        {
+          for(size_t i = n ; i < size_ ; ++i)
+          {
+            reset(i);
+          }
+          size_ = n;
+
+          size_t count = n;
+          size_t level = 0;
+          do
+          {
+            count = (count + 63) / 64;
+            if(level == levels_.size())
+            {
+              levels_.emplace_back(count, 0, levels_.get_allocator());
+              if(level)
+              {
+                const level_type& below = levels_[level - 1];
+                for(size_t w = 0 ; w < below.size() ; ++w)
+                {
+                  if(below[w])
+                  {
+                    levels_[level][w / 64] |= mask_(w);
+                  }
+                }
+              }
+            }
+            else
+            {
+              levels_[level].resize(count, 0);
+            }
+            ++level;
+          } while(count > 1);
+          levels_.resize(level);
+        }
+
+        bool test(size_t i) const
+        {
+          return (i < size_) && (levels_[0][i / 64] & mask_(i));
+        }
+
+        void set(size_t i)
+        {
+          for(level_type& level : levels_)
+          {
+            uint64_t& word = level[i / 64];
+            bool      was  = (word != 0);
+            word |= mask_(i);
+            if(was)
+            {
+              break;
+            }
+            i /= 64;
+          }
+        }
+
+        void reset(size_t i)
+        {
+          for(level_type& level : levels_)
+          {
+            uint64_t& word = level[i / 64];
+            word &= ~mask_(i);
+            if(word)
+            {
+              break;
+            }
+            i /= 64;
+          }
+        }
+
+        size_t find_first() const
+        {
+          size_t ret = 0;
+          for(size_t level = levels_.size() ; level-- > 0 ;)
+          {
+            if(ret >= levels_[level].size() || !levels_[level][ret])
+            {
+              return npos();
+            }
+            ret = ret * 64 + ctz(levels_[level][ret]);
+          }
+          return ret;
+        }
+
+      protected:
+        typedef std::vector<uint64_t, resource_allocator<uint64_t>> level_type;
+        typedef resource_allocator<level_type>                      level_allocator_type;
+
+        static uint64_t mask_(size_t i)
+        {
+          return (uint64_t)1 << (i % 64);
+        }
+
+      private:
+        std::vector<level_type, level_allocator_type> levels_;
+        size_t                                        size_;
+    };
+  }
+}
+
+#endif
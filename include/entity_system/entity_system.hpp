@@ -4,13 +4,135 @@
 # include <entity_system/forwards.hpp>
 # include <entity_system/event_dispatcher.hpp>
 # include <entity_system/segment.hpp>
+# include <entity_system/archetype.hpp>
+# include <entity_system/soa.hpp>
 
 # include <bitset>
 # include <map>
 # include <limits>
+# include <chrono>
+# include <numeric>
 
 namespace entity_system
 {
+  /**
+   * number of objects per segment used to store T (component or entity_type of a world)
+   *
+   * specialize it to use wide segments for hot components :
+   * template <> struct segment_size<position> : std::integral_constant<size_t, 1024> {};
+   * template <> struct segment_size<entity<world_type>> : std::integral_constant<size_t, 4096> {};
+   */
+  template <class T> struct segment_size : std::integral_constant<size_t, 8>
+  {
+  };
+
+  /**
+   * number of entities looked ahead when a query walks the pool of T (or archetypes starting with T) :
+   * their entity, mask and components are prefetched while the current one is processed
+   *
+   * disabled by default (out of order execution often overlaps the misses already),
+   * measure with bench_entity_system and enable it for pools larger than the caches :
+   * template <> struct prefetch_distance<position> : std::integral_constant<size_t, 16> {};
+   */
+  template <class T> struct prefetch_distance : std::integral_constant<size_t, 0>
+  {
+  };
+
+  /**
+   * components stored in dynamic_segment (with holes), reached by entity -> component id mapping
+   */
+  struct segment_storage
+  {
+  };
+
+  /**
+   * components packed in a dense array (swap and pop on removal) with an entity -> index table
+   */
+  struct sparse_set_storage
+  {
+  };
+
+  /**
+   * components stored by archetype : entities with the same set of archetype components
+   * share chunks with one column per component, and move between archetypes when
+   * an archetype component is added or removed
+   */
+  struct archetype_storage
+  {
+  };
+
+  /**
+   * components packed like sparse_set_storage, each field (declared by soa_fields<T>) in its own column
+   */
+  struct soa_storage
+  {
+  };
+
+  /**
+   * no storage : the component is only the bit of the entity mask (T must be empty),
+   * get_component/new_component return a shared instance (opt-in, cf component_storage)
+   */
+  struct tag_storage
+  {
+  };
+
+  /**
+   * storage policy of component T (segment_storage by default, empty components included)
+   *
+   * template <> struct component_storage<position> { typedef sparse_set_storage type; };
+   * template <> struct component_storage<sleeping> { typedef tag_storage type; };
+   */
+  template <class T> struct component_storage
+  {
+    typedef segment_storage type;
+  };
+
+  /**
+   * type returned by get_component<T>/new_component<T> : T* or a proxy for struct of arrays
+   */
+  template <class T, class Storage = typename component_storage<T>::type> struct component_pointer
+  {
+    typedef T* type;
+  };
+
+  template <class T> struct component_pointer<T, soa_storage>
+  {
+    typedef soa_pointer<T> type;
+  };
+
+  /**
+   * query terms : entities without any of T, components T that may be missing
+   *
+   * em.for_each<position, without<sleeping>, optional<life>>([](entity_type& e, position& p, life* l){ ... });
+   */
+  template <class ... T> struct without
+  {
+  };
+
+  template <class ... T> struct optional
+  {
+  };
+
+  /**
+   * entity id with the generation of its slot : stale once the entity is deleted, even if the slot is reused
+   * (a default handle is never alive)
+   */
+  struct entity_handle
+  {
+    entity_id_type id;
+    uint32_t       generation;
+
+    bool operator==(const entity_handle& other) const
+    {
+      return id == other.id && generation == other.generation;
+    }
+
+    bool operator!=(const entity_handle& other) const
+    {
+      return !(*this == other);
+    }
+  };
+
   namespace detail
   {
     template <class T, class Tuple> struct components_index;
@@ -23,6 +145,182 @@ namespace entity_system
         static const std::size_t value = 1 + components_index<T, std::tuple<Types...>>::value;
     };
 
+    /**
+     * column of T in the archetype store of a world (void if T is stored elsewhere)
+     */
+    template <class T> struct archetype_column
+    {
+      typedef typename std::conditional<std::is_same<typename component_storage<T>::type, archetype_storage>::value, T, void>::type type;
+    };
+
+    template <class ... T> struct all_archetype;
+
+    template <> struct all_archetype<> : std::true_type
+    {
+    };
+
+    template <class T, class ... Types> struct all_archetype<T, Types...> : std::integral_constant<bool, std::is_same<typename component_storage<T>::type, archetype_storage>::value && all_archetype<Types...>::value>
+    {
+    };
+
+    template <class ... T> struct type_list
+    {
+    };
+
+    template <class ... L> struct concat;
+
+    template <> struct concat<>
+    {
+      typedef type_list<> type;
+    };
+
+    template <class ... T> struct concat<type_list<T...>>
+    {
+      typedef type_list<T...> type;
+    };
+
+    template <class ... T, class ... U, class ... L> struct concat<type_list<T...>, type_list<U...>, L...> : concat<type_list<T..., U...>, L...>
+    {
+    };
+
+    /**
+     * components required, excluded and optional of a query term
+     */
+    template <class T> struct query_term
+    {
+      typedef type_list<T> required_type;
+      typedef type_list<>  excluded_type;
+      typedef type_list<>  optional_type;
+    };
+
+    template <class ... T> struct query_term<without<T...>>
+    {
+      typedef type_list<>     required_type;
+      typedef type_list<T...> excluded_type;
+      typedef type_list<>     optional_type;
+    };
+
+    template <class ... T> struct query_term<optional<T...>>
+    {
+      typedef type_list<>     required_type;
+      typedef type_list<>     excluded_type;
+      typedef type_list<T...> optional_type;
+    };
+
+    template <class ... Q> struct query
+    {
+      typedef typename concat<typename query_term<Q>::required_type...>::type required_type;
+      typedef typename concat<typename query_term<Q>::excluded_type...>::type excluded_type;
+      typedef typename concat<typename query_term<Q>::optional_type...>::type optional_type;
+    };
+
+    template <class ... T> struct all_sparse_set;
+
+    template <> struct all_sparse_set<> : std::true_type
+    {
+    };
+
+    template <class T, class ... Types> struct all_sparse_set<T, Types...> : std::integral_constant<bool, std::is_same<typename component_storage<T>::type, sparse_set_storage>::value && all_sparse_set<Types...>::value>
+    {
+    };
+
+    /**
+     * how for_entities_with finds entities
+     */
+    struct scan_entities
+    {
+    };
+
+    struct scan_smallest_pool
+    {
+    };
+
+    struct scan_archetypes
+    {
+    };
+
+    /**
+     * scan of a query with required components C and excluded E
+     */
+    template <class Required, class Excluded> struct scan_of;
+
+    template <class ... C, class ... E> struct scan_of<type_list<C...>, type_list<E...>>
+    {
+      typedef typename std::conditional<sizeof...(C) == 0, scan_entities,
+              typename std::conditional<all_archetype<C..., E...>::value, scan_archetypes, scan_smallest_pool>::type>::type type;
+    };
+
+    /**
+     * order n positions by less(owner(i), owner(j)) with swap(i, j) : fully when budget is max,
+     * otherwise by insertion sort with at most budget swaps, return true if sorted
+     */
+    template <class O, class S, class L> bool sort_positions(size_t n, O && owner, S && swap, L && less, size_t budget, memory_resource* resource)
+    {
+      typedef std::vector<size_t, resource_allocator<size_t>> positions_type;
+
+      if(budget == std::numeric_limits<size_t>::max())
+      {
+        positions_type order(n, 0, resource_allocator<size_t>(resource));
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(), [&](size_t i, size_t j)
+        {
+          return less(owner(i), owner(j));
+        });
+
+        // target[i] : final position of the element at i, each swap puts one element in place
+        positions_type target(n, 0, resource_allocator<size_t>(resource));
+        for(size_t i = 0 ; i < n ; ++i)
+        {
+          target[order[i]] = i;
+        }
+        for(size_t i = 0 ; i < n ; ++i)
+        {
+          while(target[i] != i)
+          {
+            size_t t = target[i];
+            swap(i, t);
+            std::swap(target[i], target[t]);
+          }
+        }
+        return true;
+      }
+
+      for(size_t i = 1 ; i < n ; ++i)
+      {
+        for(size_t j = i ; j > 0 && less(owner(j), owner(j - 1)) ; --j)
+        {
+          if(!budget)
+          {
+            return false;
+          }
+          --budget;
+          swap(j - 1, j);
+        }
+      }
+      return true;
+    }
+
+    /**
+     * initializer of create_batch for the entity i : a functor called with i, or a value
+     */
+    template <class I> auto batch_value(I& init, size_t i, int) -> decltype(init(i))
+    {
+      return init(i);
+    }
+
+    template <class I> const I& batch_value(I& init, size_t, long)
+    {
+      return init;
+    }
+
+    /**
+     * expand a value once per type of a pack
+     */
+    template <class, class V> V& repeat(V& value)
+    {
+      return value;
+    }
+
     template <class ...> struct delete_all_components;
     template <class E, class ... Tuples> struct delete_all_components <E, std::tuple<Tuples...>>
     {
@@ -45,16 +343,17 @@ namespace entity_system
       typedef std::bitset<sizeof...(Components)> component_mask_type;
       typedef std::tuple<Components...>          components_type;
 
-      world()
-        : entity_manager_(*this)
-        , system_manager_(*this)
+      world(memory_resource* resource = default_resource())
+        : resource_(resource)
+        , entity_manager_(*this, resource)
+        , system_manager_(*this, resource)
       {
       }
 
       template <class ... C> static constexpr component_mask_type get_component_mask()
       {
         component_mask_type ret;
-        for(std::size_t index : {detail::components_index<C, components_type>::value...})
+        for(std::size_t index : std::initializer_list<std::size_t>{detail::components_index<C, components_type>::value...})
         {
           ret[index] = true;
         }
@@ -65,8 +364,10 @@ namespace entity_system
       const entity_manager_type& get_entity_manager() const { return entity_manager_; }
       system_manager_type& get_system_manager() { return system_manager_; }
       const system_manager_type& get_system_manager() const { return system_manager_; }
+      memory_resource* get_memory_resource() const { return resource_; }
 
     private:
+      memory_resource*    resource_;
       entity_manager_type entity_manager_;
       system_manager_type system_manager_;
   };
@@ -93,13 +394,19 @@ namespace entity_system
       }
 
       entity_id_type get_id() const;
+      entity_handle get_handle() const;
       const component_mask_type& get_component_mask() const { return mask_component_; }
 
-      template <class T> T*   get_component();
-      template <class T, class ... ARGS> T* new_component(ARGS && ... args);
+      template <class T> typename component_pointer<T>::type get_component();
+      template <class T, class ... ARGS> typename component_pointer<T>::type new_component(ARGS && ... args);
       template <class T> void delete_component();
       void delete_all_components()
       {
+        // archetype components are dropped in one step
+        if((mask_component_ & entity_manager_type::archetype_mask_()).any())
+        {
+          entity_manager_.release_archetype_(*this);
+        }
         detail::delete_all_components<self_type, components_type>::process(*this);
       }
 
@@ -117,165 +424,2260 @@ namespace entity_system
 
       friend entity_type;
 
-      entity_manager(world_type& w)
+    protected:
+      typedef archetype_store<std::tuple<typename detail::archetype_column<Components>::type...>> archetypes_type;
+      typedef detail::mask_words<detail::nb_words(sizeof...(Components))>                        mask_words_type;
+      typedef detail::mask_columns<detail::nb_words(sizeof...(Components))>                      masks_type;
+
+    public:
+
+      entity_manager(world_type& w, memory_resource* resource = default_resource())
         : world_(w)
+        , resource_(resource)
+        , archetypes_(resource)
+        , components_(component_argument_<Components>(resource)...)
+        , groups_(groups_allocator_type(resource))
+        , masks_(resource)
+        , generations_(generations_allocator_type(resource))
+        , generations_floor_(0)
+        , size_(0)
+        , entities_(resource)
+      {
+      }
+
+      ~entity_manager()
+      {
+      }
+
+      entity_type* new_entity();
+      void    delete_entity(const entity_type& e);
+
+      /**
+       * create n entities with components C, the i-th initializer gives the C of each one : a value
+       * copied in all, or a functor called with the index of the entity in the batch returning it
+       * (slots and pools are reserved once, archetype components are built in their final archetype,
+       * masks and groups are updated once per entity)
+       *
+       * em.create_batch<position, velocity>(10000, [](size_t i) { return position(i, 0); }, velocity(0, 1));
+       */
+      template <class ... C, class ... I> void create_batch(size_t n, I && ... init);
+
+      /**
+       * number of entities
+       */
+      size_t size() const
+      {
+        return size_;
+      }
+
+      /**
+       * handle on e, checked by get/alive/get_component
+       */
+      entity_handle get_handle(const entity_type& e) const
+      {
+        return entity_handle{get_id_(e), generations_[entity_index_(e)]};
+      }
+
+      /**
+       * the entity of handle is not deleted
+       */
+      bool alive(const entity_handle& handle) const
+      {
+        // generations of live entities are odd, a forged id may point outside of its segment
+        if(!(handle.generation & 1) || !entities_.has(handle.id))
+        {
+          return false;
+        }
+        size_t index = entities_type::to_index(handle.id);
+        return index < generations_.size() && generations_[index] == handle.generation;
+      }
+
+      /**
+       * entity of handle, nullptr if it was deleted
+       */
+      entity_type* get(const entity_handle& handle)
+      {
+        return (alive(handle) ? &entities_.at(handle.id)->data() : nullptr);
+      }
+
+      /**
+       * component C of the entity of handle, nullptr if it was deleted or has no C
+       */
+      template <class C> typename component_pointer<C>::type get_component(const entity_handle& handle)
+      {
+        return (alive(handle) ? entities_.at(handle.id)->data().template get_component<C>() : nullptr);
+      }
+
+      /**
+       * preallocate storage for n entities (and the page table of each component mapping, pages stay on demand)
+       */
+      void reserve(size_t n);
+
+      /**
+       * preallocate storage for n components C, and the mapping of C for the reserved entities
+       * (kept until shrink_to_fit : adding C to them does not allocate)
+       */
+      template <class C> void reserve(size_t n)
+      {
+        component_manager<C>& manager = std::get<component_manager<C>>(components_);
+        manager.reserve(n);
+        if(entities_.capacity())
+        {
+          manager.reserve_pages(entities_type::to_id(entities_.capacity() - 1));
+        }
+      }
+
+      /**
+       * give back unused memory of entities and all components
+       */
+      void shrink_to_fit();
+
+      /**
+       * give back unused memory of components C
+       */
+      template <class C> void shrink_to_fit()
+      {
+        std::get<component_manager<C>>(components_).shrink_to_fit();
+      }
+
+      /**
+       * move at most budget components (of all types) into fewer segments, return number of moved components
+       * pointers on moved components are invalidated
+       */
+      size_t compact(size_t budget);
+
+      /**
+       * compact until nothing can be moved or time budget is spent
+       */
+      template <class Rep, class Period> size_t compact(const std::chrono::duration<Rep, Period>& budget)
+      {
+        typedef std::chrono::steady_clock clock_type;
+        clock_type::time_point deadline = clock_type::now() + budget;
+        size_t ret   = 0;
+        size_t moved = 0;
+        do
+        {
+          moved = compact(compact_batch_());
+          ret  += moved;
+        } while(moved && clock_type::now() < deadline);
+        return ret;
+      }
+
+      template <class C> size_t compact(size_t budget)
+      {
+        return std::get<component_manager<C>>(components_).compact(budget);
+      }
+
+      /**
+       * call functor(entity_type&, C&) for each component C, in storage order
+       * (soa_reference<C>& instead of C& for soa_storage)
+       */
+      template <class C, class F> void for_each_component(F && functor)
+      {
+        std::get<component_manager<C>>(components_).for_each([&](entity_id_type entity_id, auto& component)
+        {
+          functor(entities_.get(entity_id)->data(), component);
+        });
+      }
+
+      /**
+       * columns of components C stored as struct of arrays (valid until next change of the pool)
+       */
+      template <class C> soa_columns<C> get_columns()
+      {
+        return std::get<component_manager<C>>(components_).columns();
+      }
+
+      /**
+       * order the pool of C (order of for_each_component and of the queries walking it) with less(c1, c2),
+       * fully or with at most budget moves of an insertion sort (cheap on a nearly sorted pool, call it
+       * once per tick), return true when the pool is sorted
+       * pointers on components C are invalidated
+       */
+      template <class C, class L> bool sort(L && less, size_t budget = std::numeric_limits<size_t>::max())
+      {
+        static_assert(!std::is_same<typename component_storage<C>::type, archetype_storage>::value, "archetype rows can not be sorted");
+        component_manager<C>& manager = std::get<component_manager<C>>(components_);
+        return manager.sort([&](entity_id_type a, entity_id_type b)
+        {
+          return less(*manager.at(a), *manager.at(b));
+        }, budget, resource_);
+      }
+
+      /**
+       * order the pool of C like the entities
+       */
+      template <class C> bool sort_by_entity(size_t budget = std::numeric_limits<size_t>::max())
+      {
+        static_assert(!std::is_same<typename component_storage<C>::type, archetype_storage>::value, "archetype rows can not be sorted");
+        return std::get<component_manager<C>>(components_).sort([](entity_id_type a, entity_id_type b)
+        {
+          return a < b;
+        }, budget, resource_);
+      }
+
+      /**
+       * order the pool of C like the pool of By (entities without By last) : joined iterations read both in order
+       */
+      template <class C, class By> bool sort_like(size_t budget = std::numeric_limits<size_t>::max())
+      {
+        static_assert(!std::is_same<typename component_storage<C>::type, archetype_storage>::value, "archetype rows can not be sorted");
+        const component_manager<By>& by = std::get<component_manager<By>>(components_);
+        return std::get<component_manager<C>>(components_).sort([&](entity_id_type a, entity_id_type b)
+        {
+          return by.position(a) < by.position(b);
+        }, budget, resource_);
+      }
+
+      /**
+       * entities with all components C, scanned from the smallest pool of C (chosen at each call)
+       */
+      template <class ... C> class view
+      {
+        public:
+          view(entity_manager& manager)
+            : manager_(manager)
+          {
+          }
+
+          /**
+           * size of the smallest pool (upper bound of the number of entities)
+           */
+          size_t size_hint() const
+          {
+            return manager_.template smallest_pool_<C...>().second;
+          }
+
+          /**
+           * call functor(entity_type&) for each entity with all components C
+           * (functor may delete the current entity or its components)
+           */
+          template <class F> void for_each(F && functor)
+          {
+            manager_.template for_each_in_view_<C...>(query_words_<>(), functor);
+          }
+
+        private:
+          entity_manager& manager_;
+      };
+
+      template <class ... C> view<C...> get_view()
+      {
+        return view<C...>(*this);
+      }
+
+      /**
+       * resumable walk over the entities with all components C in entity order, one slice per call
+       * (the position is an entity id : entities created or deleted between two calls are handled,
+       * the ones created before the position are visited on the next pass)
+       */
+      template <class ... C> class cursor
+      {
+        public:
+          cursor(entity_manager& manager)
+            : manager_(manager)
+            , position_(0)
+          {
+          }
+
+          /**
+           * call functor(entity_type&) for at most max_entities entities from where the last call stopped,
+           * return true if the pass is over (the next call starts a new one)
+           * (functor may delete the current entity or its components)
+           */
+          template <class F> bool for_each(size_t max_entities, F && functor)
+          {
+            return manager_.template advance_<C...>(position_, max_entities, std::numeric_limits<size_t>::max(), functor);
+          }
+
+          /**
+           * same until the pass is over or time budget is spent
+           * (the clock is read after each batch of scanned entities, matching or not)
+           */
+          template <class Rep, class Period, class F> bool for_each(const std::chrono::duration<Rep, Period>& budget, F && functor)
+          {
+            typedef std::chrono::steady_clock clock_type;
+            clock_type::time_point deadline = clock_type::now() + budget;
+            bool done = false;
+            do
+            {
+              done = manager_.template advance_<C...>(position_, std::numeric_limits<size_t>::max(), cursor_batch_(), functor);
+            } while(!done && clock_type::now() < deadline);
+            return done;
+          }
+
+          /**
+           * restart from the first entity
+           */
+          void reset()
+          {
+            position_ = 0;
+          }
+
+        private:
+          entity_manager& manager_;
+          entity_id_type  position_;
+      };
+
+      template <class ... C> cursor<C...> get_cursor()
       {
+        return cursor<C...>(*this);
       }
 
-      ~entity_manager()
-      {
-      }
+      /**
+       * structural changes recorded without touching the world, applied later by entity_manager::apply :
+       * use one buffer per thread (a buffer is not shared, its memory resource must be thread safe)
+       *
+       * entities are designated by handle, the ones created by the buffer by the handle returned by
+       * its new_entity (only valid in this buffer) ; commands on deleted entities are skipped
+       */
+      class command_buffer
+      {
+        public:
+          command_buffer(memory_resource* resource = default_resource())
+            : resource_(resource)
+            , blocks_(block_allocator_type(resource))
+            , current_(0)
+            , created_(created_allocator_type(resource))
+            , nb_created_(0)
+            , nb_components_()
+          {
+          }
+
+          command_buffer(command_buffer&& other)
+            : resource_(other.resource_)
+            , blocks_(std::move(other.blocks_))
+            , current_(other.current_)
+            , created_(std::move(other.created_))
+            , nb_created_(other.nb_created_)
+            , nb_components_(other.nb_components_)
+          {
+            other.blocks_.clear();
+            other.current_    = 0;
+            other.nb_created_ = 0;
+            other.nb_components_.fill(0);
+          }
+
+          command_buffer(const command_buffer&) = delete;
+          command_buffer& operator=(const command_buffer&) = delete;
+
+          ~command_buffer()
+          {
+            clear();
+            for(block_type& block : blocks_)
+            {
+              resource_->deallocate(block.data, block.capacity, alignof(std::max_align_t));
+            }
+          }
+
+          entity_handle new_entity()
+          {
+            push_<create_command>();
+            return entity_handle{(entity_id_type)nb_created_++, local_generation_()};
+          }
+
+          void delete_entity(const entity_handle& handle)
+          {
+            push_<delete_command>(handle);
+          }
+
+          template <class C, class ... ARGS> void new_component(const entity_handle& handle, ARGS && ... args)
+          {
+            push_<new_component_command<C, typename std::decay<ARGS>::type...>>(handle, std::forward<ARGS>(args)...);
+            ++nb_components_[detail::components_index<C, std::tuple<Components...>>::value];
+          }
+
+          template <class C> void delete_component(const entity_handle& handle)
+          {
+            push_<delete_component_command<C>>(handle);
+          }
+
+          bool empty() const
+          {
+            return blocks_.empty() || (current_ == 0 && blocks_[0].size == 0);
+          }
+
+          /**
+           * drop the commands (memory is kept for the next ones)
+           */
+          void clear()
+          {
+            for_each_command_([](command_header& header, void* command)
+            {
+              header.destroy(command);
+            });
+            for(block_type& block : blocks_)
+            {
+              block.size = 0;
+            }
+            current_    = 0;
+            nb_created_ = 0;
+            nb_components_.fill(0);
+          }
+
+        protected:
+          friend entity_manager;
+
+          struct command_header
+          {
+            void   (*apply)(entity_manager&, command_buffer&, void*);
+            void   (*destroy)(void*);
+            size_t size;
+          };
+
+          struct block_type
+          {
+            uint8_t* data;
+            size_t   capacity;
+            size_t   size;
+          };
+
+          struct create_command
+          {
+            static void apply(entity_manager& em, command_buffer& buffer, void*)
+            {
+              buffer.created_.push_back(em.new_entity());
+            }
+          };
+
+          struct delete_command
+          {
+            delete_command(const entity_handle& handle)
+              : handle(handle)
+            {
+            }
+
+            static void apply(entity_manager& em, command_buffer& buffer, void* p)
+            {
+              const entity_handle& handle = ((delete_command*)p)->handle;
+              entity_type* e = buffer.resolve_(em, handle);
+              if(e)
+              {
+                if(handle.generation == local_generation_())
+                {
+                  buffer.created_[handle.id] = nullptr;
+                }
+                em.delete_entity(*e);
+              }
+            }
+
+            entity_handle handle;
+          };
+
+          template <class C, class ... ARGS> struct new_component_command
+          {
+            template <class ... A> new_component_command(const entity_handle& handle, A && ... args)
+              : handle(handle)
+              , args(std::forward<A>(args)...)
+            {
+            }
+
+            static void apply(entity_manager& em, command_buffer& buffer, void* p)
+            {
+              new_component_command& command = *(new_component_command*)p;
+              entity_type* e = buffer.resolve_(em, command.handle);
+              if(e)
+              {
+                command.build_(*e, std::index_sequence_for<ARGS...>());
+              }
+            }
+
+            template <size_t ... I> void build_(entity_type& e, std::index_sequence<I...>)
+            {
+              e.template new_component<C>(std::move(std::get<I>(args))...);
+            }
+
+            entity_handle       handle;
+            std::tuple<ARGS...> args;
+          };
+
+          template <class C> struct delete_component_command
+          {
+            delete_component_command(const entity_handle& handle)
+              : handle(handle)
+            {
+            }
+
+            static void apply(entity_manager& em, command_buffer& buffer, void* p)
+            {
+              entity_type* e = buffer.resolve_(em, ((delete_component_command*)p)->handle);
+              if(e)
+              {
+                e->template delete_component<C>();
+              }
+            }
+
+            entity_handle handle;
+          };
+
+          template <class T> static void destroy_(void* p)
+          {
+            ((T*)p)->~T();
+          }
+
+          static constexpr size_t header_size_()
+          {
+            return (sizeof(command_header) + alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1);
+          }
+
+          static constexpr size_t block_size_()
+          {
+            return 4096;
+          }
+
+          template <class T, class ... ARGS> void push_(ARGS && ... args)
+          {
+            static_assert(alignof(T) <= alignof(std::max_align_t), "over aligned command");
+            size_t   size = (header_size_() + sizeof(T) + alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1);
+            uint8_t* data = allocate_(size);
+            new(data) command_header{&T::apply, &destroy_<T>, size};
+            new(data + header_size_()) T(std::forward<ARGS>(args)...);
+          }
+
+          /**
+           * size bytes at the end of the current block, or of the next one able to hold them
+           */
+          uint8_t* allocate_(size_t size)
+          {
+            while(current_ < blocks_.size() && blocks_[current_].size + size > blocks_[current_].capacity)
+            {
+              if(blocks_[current_].size == 0)
+              {
+                // too small for this command : replace it
+                resource_->deallocate(blocks_[current_].data, blocks_[current_].capacity, alignof(std::max_align_t));
+                blocks_.erase(blocks_.begin() + current_);
+              }
+              else
+              {
+                ++current_;
+              }
+            }
+            if(current_ == blocks_.size())
+            {
+              size_t capacity = std::max(size, block_size_());
+              blocks_.push_back(block_type{(uint8_t*)resource_->allocate(capacity, alignof(std::max_align_t)), capacity, 0});
+            }
+
+            block_type& block = blocks_[current_];
+            uint8_t*    ret   = block.data + block.size;
+            block.size += size;
+            return ret;
+          }
+
+          template <class F> void for_each_command_(F && functor)
+          {
+            for(size_t b = 0 ; b < blocks_.size() && b <= current_ ; ++b)
+            {
+              for(size_t offset = 0 ; offset < blocks_[b].size ;)
+              {
+                command_header& header = *(command_header*)(blocks_[b].data + offset);
+                functor(header, blocks_[b].data + offset + header_size_());
+                offset += header.size;
+              }
+            }
+          }
+
+          /**
+           * generation of the handles created by the buffer : even so never the one of a live entity, nor 0 (default handle)
+           */
+          static constexpr uint32_t local_generation_()
+          {
+            return std::numeric_limits<uint32_t>::max() - 1;
+          }
+
+          entity_type* resolve_(entity_manager& em, const entity_handle& handle)
+          {
+            if(handle.generation == local_generation_())
+            {
+              return (handle.id < created_.size() ? created_[handle.id] : nullptr);
+            }
+            return em.get(handle);
+          }
+
+          void apply_(entity_manager& em)
+          {
+            created_.clear();
+            created_.reserve(nb_created_);
+            for_each_command_([&](command_header& header, void* command)
+            {
+              header.apply(em, *this, command);
+            });
+            clear();
+          }
+
+          typedef resource_allocator<block_type>                      block_allocator_type;
+          typedef std::vector<block_type, block_allocator_type>       blocks_type;
+          typedef resource_allocator<entity_type*>                    created_allocator_type;
+          typedef std::vector<entity_type*, created_allocator_type>   created_type;
+
+        private:
+          memory_resource*                          resource_;
+          blocks_type                               blocks_;
+          size_t                                    current_;
+          created_type                              created_;    // entities created by the buffer, while it is applied
+          size_t                                    nb_created_;
+          std::array<size_t, sizeof...(Components)> nb_components_;
+      };
+
+      /**
+       * values of components to instantiate entities from, copied from an entity or set one by one
+       */
+      class prefab
+      {
+        public:
+          prefab(memory_resource* resource = default_resource())
+            : resource_(resource)
+            , values_()
+          {
+          }
+
+          /**
+           * copy of the components of e (the ones not copy constructible are left out)
+           */
+          prefab(entity_type& e, memory_resource* resource = default_resource())
+            : prefab(resource)
+          {
+            int tmp[] = {0, (e.get_component_mask()[detail::components_index<Components, std::tuple<Components...>>::value] ? (copy_<Components>(e, std::is_copy_constructible<Components>()), 0) : 0)...};
+            (void)tmp;
+          }
+
+          prefab(const prefab&) = delete;
+          prefab& operator=(const prefab&) = delete;
+
+          ~prefab()
+          {
+            for(size_t index = 0 ; index < values_.size() ; ++index)
+            {
+              reset_(index);
+            }
+          }
+
+          /**
+           * value of component C built with args (replaces the previous one)
+           */
+          template <class C, class ... ARGS> C* set(ARGS && ... args)
+          {
+            const size_t index = detail::components_index<C, std::tuple<Components...>>::value;
+            reset_(index);
+            values_[index] = new(resource_->allocate(sizeof(C), alignof(C))) C(std::forward<ARGS>(args)...);
+            mask_[index]   = true;
+            return (C*)values_[index];
+          }
+
+          template <class C> const C* get() const
+          {
+            return (const C*)values_[detail::components_index<C, std::tuple<Components...>>::value];
+          }
+
+          template <class C> void reset()
+          {
+            reset_(detail::components_index<C, std::tuple<Components...>>::value);
+          }
+
+          const component_mask_type& get_component_mask() const
+          {
+            return mask_;
+          }
+
+        protected:
+          template <class C> void copy_(entity_type& e, std::true_type)
+          {
+            set<C>(component_value_<C>(e));
+          }
+
+          template <class C> void copy_(entity_type&, std::false_type)
+          {
+          }
+
+          void reset_(size_t index)
+          {
+            static const detail::column_ops* ops[] = {detail::column_ops_of<Components>::get()...};
+            if(values_[index])
+            {
+              ops[index]->destroy(values_[index]);
+              resource_->deallocate(values_[index], ops[index]->size, ops[index]->alignment);
+              values_[index] = nullptr;
+              mask_[index]   = false;
+            }
+          }
+
+        private:
+          memory_resource*                         resource_;
+          std::array<void*, sizeof...(Components)> values_;
+          component_mask_type                      mask_;
+      };
+
+      /**
+       * create count entities with a copy of the components of p
+       * (like create_batch : reserved once, archetype rows built in their archetype, masks set once per entity)
+       */
+      void instantiate(const prefab& p, size_t count)
+      {
+        int tmp[] = {0, (p.template get<Components>() ? (reserve_more_<Components>(count), 0) : 0)...};
+        (void)tmp;
+        reserve_entities_(count);
+
+        typename archetypes_type::archetype_id_type archetype = archetypes_.archetype_of(p.get_component_mask() & archetype_mask_() & copyable_mask_());
+        for(size_t i = 0 ; i < count ; ++i)
+        {
+          entity_type& e = *new_entity();
+          if(archetype)
+          {
+            archetypes_.add_row(e.get_id(), archetype);
+          }
+
+          mask_words_type words = {};
+          int built[] = {0, (p.template get<Components>() ? (copy_component_<Components>(e, *p.template get<Components>(), words, std::is_copy_constructible<Components>()), 0) : 0)...};
+          (void)built;
+          masks_.set(entity_index_(e), words);
+          update_groups_(e, component_mask_type());
+        }
+      }
+
+      /**
+       * new entity with a copy of each component of e (the ones not copy constructible are left out)
+       */
+      entity_type* clone(entity_type& e)
+      {
+        entity_type& ret = *new_entity();
+        typename archetypes_type::archetype_id_type archetype = archetypes_.archetype_of(e.mask_component_ & archetype_mask_() & copyable_mask_());
+        if(archetype)
+        {
+          archetypes_.add_row(ret.get_id(), archetype);
+        }
+
+        mask_words_type words = {};
+        int tmp[] = {0, (e.mask_component_[detail::components_index<Components, std::tuple<Components...>>::value] ? (clone_component_<Components>(e, ret, words), 0) : 0)...};
+        (void)tmp;
+        masks_.set(entity_index_(ret), words);
+        update_groups_(ret, component_mask_type());
+        return &ret;
+      }
+
+      /**
+       * apply the commands of buffer, then clear it
+       */
+      void apply(command_buffer& buffer)
+      {
+        apply(&buffer, &buffer + 1);
+      }
+
+      /**
+       * apply the buffers of [first, last) one after the other, each in the order of its commands
+       * (entities and components created are reserved once for all buffers)
+       */
+      template <class It> void apply(It first, It last)
+      {
+        size_t nb_created = 0;
+        std::array<size_t, sizeof...(Components)> nb_components = {};
+        for(It it = first ; it != last ; ++it)
+        {
+          command_buffer& buffer = *it;
+          nb_created += buffer.nb_created_;
+          for(size_t i = 0 ; i < nb_components.size() ; ++i)
+          {
+            nb_components[i] += buffer.nb_components_[i];
+          }
+        }
+
+        reserve_entities_(nb_created);
+        int tmp[] = {0, (reserve_more_<Components>(nb_components[detail::components_index<Components, std::tuple<Components...>>::value]), 0)...};
+        (void)tmp;
+
+        for(It it = first ; it != last ; ++it)
+        {
+          command_buffer& buffer = *it;
+          buffer.apply_(*this);
+        }
+      }
+
+      /**
+       * packed list of the entities with all components of a mask, kept up to date
+       * when components are added or removed
+       */
+      class group
+      {
+        public:
+          typedef resource_allocator<entity_type*>            members_allocator_type;
+          typedef std::vector<entity_type*, members_allocator_type> members_type;
+          typedef typename members_type::const_iterator       const_iterator;
+
+          group(const component_mask_type& mask, memory_resource* resource)
+            : mask_(mask)
+            , members_(members_allocator_type(resource))
+            , positions_(positions_allocator_type(resource))
+          {
+          }
+
+          group(const group&) = delete;
+          group& operator=(const group&) = delete;
+
+          const component_mask_type& get_component_mask() const
+          {
+            return mask_;
+          }
+
+          size_t size() const
+          {
+            return members_.size();
+          }
+
+          bool empty() const
+          {
+            return members_.empty();
+          }
+
+          const_iterator begin() const
+          {
+            return members_.begin();
+          }
+
+          const_iterator end() const
+          {
+            return members_.end();
+          }
+
+          bool contains(const entity_type& e) const
+          {
+            entity_id_type entity_id = e.get_id();
+            return entity_id < positions_.size() && positions_[entity_id] != npos_();
+          }
+
+          /**
+           * call functor(entity_type&) for each member, last ones first
+           * (functor may delete the current entity or its components)
+           */
+          template <class F> void for_each(F && functor)
+          {
+            for(size_t i = members_.size() ; i-- > 0 ;)
+            {
+              functor(*members_[i]);
+              i = std::min(i, members_.size());
+            }
+          }
+
+          /**
+           * mask of e was before
+           */
+          void update(entity_type& e, const component_mask_type& before)
+          {
+            bool was = ((before & mask_) == mask_);
+            bool is  = ((e.get_component_mask() & mask_) == mask_);
+            if(was != is)
+            {
+              entity_id_type entity_id = e.get_id();
+              if(is)
+              {
+                if(entity_id >= positions_.size())
+                {
+                  positions_.resize(entity_id + 1, npos_());
+                }
+                positions_[entity_id] = (uint32_t)members_.size();
+                members_.push_back(&e);
+              }
+              else
+              {
+                // swap and pop
+                uint32_t position = positions_[entity_id];
+                members_[position] = members_.back();
+                positions_[members_[position]->get_id()] = position;
+                members_.pop_back();
+                positions_[entity_id] = npos_();
+              }
+            }
+          }
+
+        protected:
+          typedef resource_allocator<uint32_t>                  positions_allocator_type;
+          typedef std::vector<uint32_t, positions_allocator_type> positions_type;
+
+          static constexpr uint32_t npos_()
+          {
+            return std::numeric_limits<uint32_t>::max();
+          }
+
+        private:
+          component_mask_type mask_;
+          members_type        members_;
+          positions_type      positions_;
+      };
+
+      /**
+       * group of entities with all components C, built on first call then maintained incrementally
+       */
+      template <class ... C> group& get_group()
+      {
+        static_assert(sizeof...(C) > 0, "a group needs at least one component");
+        const component_mask_type& mask = query_mask_<C...>();
+        for(const group_ptr_type& g : groups_)
+        {
+          if(g->get_component_mask() == mask)
+          {
+            return *g;
+          }
+        }
+
+        group* g = new(resource_->allocate(sizeof(group), alignof(group))) group(mask, resource_);
+        groups_.emplace_back(g, group_deleter{resource_});
+        group& ret = *groups_.back();
+        component_mask_type none;
+        for_each_in_view_<C...>(query_words_<>(), [&](entity_type& e)
+        {
+          ret.update(e, none);
+        });
+        return ret;
+      }
+
+      /**
+       * stop to maintain the group of C
+       */
+      template <class ... C> void delete_group()
+      {
+        const component_mask_type& mask = query_mask_<C...>();
+        groups_.erase(std::remove_if(groups_.begin(), groups_.end(), [&](const group_ptr_type& g)
+        {
+          return g->get_component_mask() == mask;
+        }), groups_.end());
+      }
+
+      /**
+       * call functor(entity_type&) for each entity with all components of the query Q
+       * and none of its without<T...> terms (optional<T...> terms are ignored)
+       * (only matching archetypes are scanned when all its components are archetype components,
+       * otherwise the smallest pool of the required ones)
+       */
+      template <class ... Q, class F> void for_entities_with(F && functor)
+      {
+        typedef detail::query<Q...> query_type;
+        for_entities_with_(functor, typename query_type::required_type(), typename query_type::excluded_type());
+      }
+
+      /**
+       * call functor(entity_type&, C&..., O...) for each entity matching the query Q, with C the required
+       * components (looked up once without checks, soa_storage ones given as soa_reference<C>) then
+       * the components O of its optional<T...> terms (as component_pointer<O>::type, nullptr when missing)
+       * (functor may delete the current entity or its components)
+       */
+      template <class ... Q, class F> void for_each(F && functor)
+      {
+        typedef detail::query<Q...> query_type;
+        for_each_(functor, typename query_type::required_type(), typename query_type::excluded_type(), typename query_type::optional_type());
+      }
+
+      /**
+       * call functor(size_t n, C*..., const entity_id_type* ids) for each run of n entities whose
+       * components C are contiguous : the chunks of the matching archetypes, or the whole pool of a
+       * single sparse set component (functor must not add nor remove components C)
+       *
+       * only these storages keep plain arrays of C : segment pools (C next to its owner id) and soa
+       * pools (one array per field) are rejected at compile time
+       */
+      template <class ... C, class F> void for_each_chunk(F && functor)
+      {
+        static_assert(sizeof...(C) > 0, "for_each_chunk needs at least one component");
+        for_each_chunk_<C...>(functor, typename std::conditional<detail::all_archetype<C...>::value, detail::scan_archetypes, detail::scan_smallest_pool>::type());
+      }
+
+    protected:
+      /**
+       * build component C of a new entity of a batch, its bit is set in the mask of e and in words
+       */
+      template <class C, class V> void batch_component_(entity_type& e, V && value, mask_words_type& words)
+      {
+        const size_t pos = detail::components_index<C, std::tuple<Components...>>::value;
+        if(build_component_<C>(e, std::forward<V>(value), typename component_storage<C>::type()))
+        {
+          e.mask_component_[pos] = true;
+          words.words[pos / 64] |= (uint64_t)1 << (pos % 64);
+        }
+      }
+
+      template <class C, class V, class S> typename component_pointer<C>::type build_component_(entity_type& e, V && value, S)
+      {
+        return std::get<component_manager<C>>(components_).acquire(e, std::forward<V>(value));
+      }
+
+      /**
+       * the row of e is already in the archetype of the batch
+       */
+      template <class C, class V> typename component_pointer<C>::type build_component_(entity_type& e, V && value, archetype_storage)
+      {
+        return std::get<component_manager<C>>(components_).build(e, std::forward<V>(value));
+      }
+
+      /**
+       * copy component C of e in copy (a pool may grow : room is made before its source is read)
+       */
+      template <class C> void clone_component_(entity_type& e, entity_type& copy, mask_words_type& words)
+      {
+        reserve_more_<C>(1);
+        copy_component_<C>(copy, component_value_<C>(e), words, std::is_copy_constructible<C>());
+      }
+
+      template <class C, class V> void copy_component_(entity_type& e, const V& value, mask_words_type& words, std::true_type)
+      {
+        batch_component_<C>(e, value, words);
+      }
+
+      template <class C, class V> void copy_component_(entity_type&, const V&, mask_words_type&, std::false_type)
+      {
+      }
+
+      /**
+       * component C of e as a value (soa_storage components are gathered)
+       */
+      template <class C> static typename std::enable_if<!std::is_same<typename component_storage<C>::type, soa_storage>::value, const C&>::type component_value_(entity_type& e)
+      {
+        return *e.template get_component<C>();
+      }
+
+      template <class C> static typename std::enable_if<std::is_same<typename component_storage<C>::type, soa_storage>::value, C>::type component_value_(entity_type& e)
+      {
+        return e.template get_component<C>()->load();
+      }
+
+      /**
+       * room for n more components C
+       */
+      template <class C> void reserve_more_(size_t n)
+      {
+        component_manager<C>& manager = std::get<component_manager<C>>(components_);
+        if(manager.size() + n > manager.capacity())
+        {
+          manager.reserve(std::max(manager.size() + n, 2 * manager.capacity()));
+        }
+      }
+
+      /**
+       * room for n more entities
+       */
+      void reserve_entities_(size_t n)
+      {
+        if(size_ + n > entities_.capacity())
+        {
+          entities_.reserve(std::max(size_ + n, 2 * entities_.capacity()));
+          masks_.reserve(entities_.capacity());
+          generations_.reserve(entities_.capacity());
+        }
+      }
+
+      /**
+       * bit pos of the component mask of e (and of its copy in masks_)
+       */
+      void set_component_bit_(entity_type& e, size_t pos, bool value)
+      {
+        component_mask_type before = e.mask_component_;
+        e.mask_component_[pos] = value;
+        masks_.set(entity_index_(e), pos, value);
+        update_groups_(e, before);
+      }
+
+      size_t entity_index_(const entity_type& e) const
+      {
+        return entities_type::to_index(entity_wrapper_type::to_wrapper(e).id());
+      }
+
+      /**
+       * words of the mask of components C, built at compile time
+       */
+      template <class ... C> static const mask_words_type& query_words_()
+      {
+        static constexpr mask_words_type words = detail::make_mask_words<detail::nb_words(sizeof...(Components))>({detail::components_index<C, std::tuple<Components...>>::value...});
+        return words;
+      }
+
+      template <class ... C> static const component_mask_type& query_mask_()
+      {
+        static const component_mask_type mask = world_type::template get_component_mask<C...>();
+        return mask;
+      }
+
+      /**
+       * mask of e changed (it was before)
+       */
+      void update_groups_(entity_type& e, const component_mask_type& before)
+      {
+        for(const group_ptr_type& g : groups_)
+        {
+          g->update(e, before);
+        }
+      }
+
+      template <class F, class ... C, class ... E> void for_entities_with_(F && functor, detail::type_list<C...> required, detail::type_list<E...> excluded)
+      {
+        for_entities_with_(functor, required, excluded, typename detail::scan_of<detail::type_list<C...>, detail::type_list<E...>>::type());
+      }
+
+      template <class F, class ... E> void for_entities_with_(F && functor, detail::type_list<>, detail::type_list<E...>, detail::scan_entities)
+      {
+        for(entity_wrapper_type* wrapper : entities_)
+        {
+          if(sizeof...(E) == 0 || masks_.test(entities_type::to_index(wrapper->id()), query_words_<>(), query_words_<E...>()))
+          {
+            functor(wrapper->data());
+          }
+        }
+      }
+
+      template <class F, class ... C, class ... E> void for_entities_with_(F && functor, detail::type_list<C...>, detail::type_list<E...>, detail::scan_smallest_pool)
+      {
+        for_each_in_view_<C...>(query_words_<E...>(), functor);
+      }
+
+      template <class F, class ... C, class ... E> void for_entities_with_(F && functor, detail::type_list<C...>, detail::type_list<E...>, detail::scan_archetypes)
+      {
+        // a is not used after functor : it may move the archetypes
+        archetypes_.for_each_row(query_mask_<C...>(), query_mask_<E...>(), [&](typename archetypes_type::archetype& a, typename archetypes_type::row_type row)
+        {
+          prefetch_row_<C...>(a, row);
+          functor(entities_.at(a.id(row))->data());
+        });
+      }
+
+      template <class F, class ... C, class ... E, class ... O> void for_each_(F && functor, detail::type_list<C...> required, detail::type_list<E...> excluded, detail::type_list<O...> optional)
+      {
+        static_assert(sizeof...(C) > 0, "for_each needs at least one required component");
+        for_each_(functor, required, excluded, optional, typename detail::scan_of<detail::type_list<C...>, detail::type_list<E...>>::type());
+      }
+
+      template <class F, class ... C, class ... E, class ... O> void for_each_(F && functor, detail::type_list<C...>, detail::type_list<E...>, detail::type_list<O...>, detail::scan_smallest_pool)
+      {
+        for_each_in_view_<C...>(query_words_<E...>(), [&](entity_type& e)
+        {
+          entity_id_type entity_id = e.get_id();
+          functor(e, *std::get<component_manager<C>>(components_).at(entity_id)..., e.template get_component<O>()...);
+        });
+      }
+
+      template <class F, class ... C, class ... E, class ... O> void for_each_(F && functor, detail::type_list<C...>, detail::type_list<E...>, detail::type_list<O...>, detail::scan_archetypes)
+      {
+        // a is not used after functor : it may move the archetypes
+        archetypes_.for_each_row(query_mask_<C...>(), query_mask_<E...>(), [&](typename archetypes_type::archetype& a, typename archetypes_type::row_type row)
+        {
+          prefetch_row_<C...>(a, row);
+          entity_type& e = entities_.at(a.id(row))->data();
+          functor(e, *a.template at<C>(row, detail::components_index<C, std::tuple<Components...>>::value)..., e.template get_component<O>()...);
+        });
+      }
+
+      template <class ... C, class F> void for_each_chunk_(F && functor, detail::scan_archetypes)
+      {
+        archetypes_.for_each(query_mask_<C...>(), [&](typename archetypes_type::archetype& a)
+        {
+          for(size_t chunk = 0 ; chunk < a.nb_chunks() ; ++chunk)
+          {
+            functor(a.chunk_size(chunk), a.template column<C>(chunk, detail::components_index<C, std::tuple<Components...>>::value)..., a.ids(chunk));
+          }
+        });
+      }
+
+      template <class ... C, class F> void for_each_chunk_(F && functor, detail::scan_smallest_pool)
+      {
+        // segment pools interleave each component with its owner id
+        static_assert(sizeof...(C) == 1 && detail::all_sparse_set<C...>::value, "only archetype components or a single sparse set component are stored contiguously");
+        int tmp[] = {(std::get<component_manager<C>>(components_).for_each_chunk(functor), 0)...};
+        (void)tmp;
+      }
+
+      /**
+       * visit at most max_entities entities with all components C after position,
+       * scanning at most max_scanned entities (with C or not)
+       */
+      template <class ... C, class F> bool advance_(entity_id_type& position, size_t max_entities, size_t max_scanned, F && functor)
+      {
+        typename entities_type::id_type pos(position);
+        for(size_t n = 0, scanned = 0 ; n < max_entities && scanned < max_scanned ; ++scanned)
+        {
+          pos = entities_.next(pos);
+          if(!entities_.has(pos))
+          {
+            position = 0;
+            return true;
+          }
+
+          if(masks_.test(entities_type::to_index(pos), query_words_<C...>()))
+          {
+            ++n;
+            functor(entities_.at(pos)->data());
+          }
+        }
+        position = pos;
+        return false;
+      }
+
+      /**
+       * index in C... and size of the smallest pool
+       */
+      template <class ... C> std::pair<size_t, size_t> smallest_pool_() const
+      {
+        size_t sizes[] = {pool_size_<C>(typename component_storage<C>::type())...};
+        size_t index   = std::min_element(sizes, sizes + sizeof...(C)) - sizes;
+        return std::make_pair(index, sizes[index]);
+      }
+
+      /**
+       * walk the smallest pool of C, or filter all entity masks when it is not much smaller
+       * (entities with a component of exclude are skipped)
+       */
+      template <class ... C, class F> void for_each_in_view_(const mask_words_type& exclude, F && functor)
+      {
+        std::pair<size_t, size_t> smallest = smallest_pool_<C...>();
+        if(smallest.second * dense_scan_ratio_() >= masks_.size())
+        {
+          masks_.for_each_match(query_words_<C...>(), exclude, [&](size_t index)
+          {
+            functor(entities_.at(entities_type::to_id(index))->data());
+          });
+        }
+        else
+        {
+          // the pool is walked in order, the mask, entity and components of the owners are random accesses
+          auto lookahead = [this](entity_id_type entity_id)
+          {
+            masks_.prefetch(entities_type::to_index(entity_id));
+            detail::prefetch(entities_.at(entity_id));
+            int tmp[] = {(std::get<component_manager<C>>(components_).prefetch(entity_id), 0)...};
+            (void)tmp;
+          };
+
+          size_t i = 0;
+          int tmp[] = {(i++ == smallest.first ? (for_each_in_pool_<C>(query_words_<C...>(), exclude, functor, lookahead), 0) : 0)...};
+          (void)tmp;
+        }
+      }
+
+      template <class C, class S> size_t pool_size_(S) const
+      {
+        return std::get<component_manager<C>>(components_).size();
+      }
+
+      /**
+       * a tag has no pool to walk : as large as the masks, so they are scanned instead
+       */
+      template <class C> size_t pool_size_(tag_storage) const
+      {
+        return masks_.size();
+      }
+
+      template <class P, class F, class L> void for_each_in_pool_(const mask_words_type& query, const mask_words_type& exclude, F && functor, L && lookahead)
+      {
+        for_each_in_pool_<P>(query, exclude, functor, lookahead, typename component_storage<P>::type());
+      }
+
+      template <class P, class F, class L, class S> void for_each_in_pool_(const mask_words_type& query, const mask_words_type& exclude, F && functor, L && lookahead, S)
+      {
+        std::get<component_manager<P>>(components_).for_each_owner([&](entity_id_type entity_id)
+        {
+          if(masks_.test(entities_type::to_index(entity_id), query, exclude))
+          {
+            functor(entities_.at(entity_id)->data());
+          }
+        }, lookahead);
+      }
+
+      template <class P, class F, class L> void for_each_in_pool_(const mask_words_type& query, const mask_words_type& exclude, F && functor, L &&, tag_storage)
+      {
+        masks_.for_each_match(query, exclude, [&](size_t index)
+        {
+          functor(entities_.at(entities_type::to_id(index))->data());
+        });
+      }
+
+      /**
+       * prefetch the entity prefetch_distance rows before row (rows are walked backward)
+       */
+      template <class C, class ... Others> void prefetch_row_(const typename archetypes_type::archetype& a, size_t row)
+      {
+        const size_t distance = prefetch_distance<C>::value;
+        if(distance && row >= distance)
+        {
+          detail::prefetch(entities_.at(a.id((typename archetypes_type::row_type)(row - distance))));
+        }
+      }
+
+      /**
+       * a dense scan of the masks costs about one pool element per dense_scan_ratio_() entities
+       */
+      static constexpr size_t dense_scan_ratio_()
+      {
+        return 16;
+      }
+
+      /**
+       * components stored in archetypes_
+       */
+      static const component_mask_type& archetype_mask_()
+      {
+        static const component_mask_type mask = []()
+        {
+          component_mask_type ret;
+          bool in_archetype[] = {false, !std::is_void<typename detail::archetype_column<Components>::type>::value...};
+          for(size_t i = 0 ; i < ret.size() ; ++i)
+          {
+            ret[i] = in_archetype[i + 1];
+          }
+          return ret;
+        }();
+        return mask;
+      }
+
+      /**
+       * copy constructible components (the ones cloned or instantiated)
+       */
+      static const component_mask_type& copyable_mask_()
+      {
+        static const component_mask_type mask = []()
+        {
+          component_mask_type ret;
+          bool copyable[] = {false, std::is_copy_constructible<Components>::value...};
+          for(size_t i = 0 ; i < ret.size() ; ++i)
+          {
+            ret[i] = copyable[i + 1];
+          }
+          return ret;
+        }();
+        return mask;
+      }
+
+      void release_archetype_(entity_type& e)
+      {
+        archetypes_.remove_all(e.get_id());
+
+        component_mask_type before = e.mask_component_;
+        e.mask_component_ &= ~archetype_mask_();
+        masks_.reset(entity_index_(e), archetype_words_());
+        update_groups_(e, before);
+      }
+
+      static const mask_words_type& archetype_words_()
+      {
+        static const mask_words_type words = []()
+        {
+          mask_words_type ret = {};
+          for(size_t i = 0 ; i < archetype_mask_().size() ; ++i)
+          {
+            if(archetype_mask_()[i])
+            {
+              ret.words[i / 64] |= (uint64_t)1 << (i % 64);
+            }
+          }
+          return ret;
+        }();
+        return words;
+      }
+
+      template <class C> typename std::enable_if<!std::is_same<typename component_storage<C>::type, archetype_storage>::value, memory_resource*>::type component_argument_(memory_resource* resource)
+      {
+        return resource;
+      }
+
+      template <class C> typename std::enable_if<std::is_same<typename component_storage<C>::type, archetype_storage>::value, archetypes_type&>::type component_argument_(memory_resource*)
+      {
+        return archetypes_;
+      }
+
+      entity_id_type get_id_(const entity_type& e) const;
+      template <class T> typename component_pointer<T>::type get_component_(const entity_type& e);
+      template <class T, class ... ARGS> typename component_pointer<T>::type new_component_(const entity_type& e, ARGS && ... args);
+      template <class T> void delete_component_(const entity_type& e);
+
+      template <class I, class T> class wrapper
+      {
+        public:
+          typedef wrapper self_type;
+          typedef I       id_type;
+          typedef T       data_type;
+
+          template <class ... ARGS> wrapper(ARGS&& ... args)
+            : id_(0)
+            , data_(std::forward<ARGS>(args)...)
+          {
+          }
+
+          static const self_type& to_wrapper(const data_type& data)
+          {
+            return *(const self_type*)((const uint8_t*)&data - ptr_id_2_data_());
+          }
+
+          /**
+           * build a wrapper at to from from (with relocate<data_type>), from is destroyed
+           */
+          static void relocate(self_type& from, void* to)
+          {
+            self_type* ret = (self_type*)to;
+            new(&ret->id_) id_type(from.id_);
+            entity_system::relocate<data_type>::process(from.data_, &ret->data_);
+          }
+
+          data_type& data()
+          {
+            return data_;
+          }
+
+          const data_type& data() const
+          {
+            return data_;
+          }
+
+          id_type& id()
+          {
+            return id_;
+          }
+
+          const id_type& id() const
+          {
+            return id_;
+          }
+
+        protected:
+          static constexpr size_t ptr_id_2_data_()
+          {
+            wrapper* tmp = 0;
+            void* p1 = tmp;
+            void* p2 = &tmp->data_;
+            return ((size_t)p2-(size_t)p1);
+          }
+
+        private:
+          id_type   id_;
+          data_type data_;
+      };
+
+      template <class Component, class Storage = typename component_storage<Component>::type> class component_manager;
+
+      template <class Component> class component_manager<Component, segment_storage>
+      {
+        public:
+          typedef Component component_type;
+
+          component_manager(memory_resource* resource)
+            : data_(resource)
+            , mapping_(resource)
+            , size_(0)
+          {
+          }
+
+          template <class ... ARGS> component_type* acquire(const entity_type&e, ARGS && ...args)
+          {
+            entity_id_type entity_id = e.get_id();
+            wrapper_type* wrapper = nullptr;
+            data_id_type  intern_component_id(0);
+
+            std::tie(wrapper, intern_component_id) = data_.acquire(std::forward<ARGS>(args)...);
+            if(wrapper)
+            {
+              mapping_.set(entity_id, intern_component_id);
+              wrapper->id() = entity_id;
+              ++size_;
+            }
+
+            return (wrapper ? &wrapper->data() : nullptr);
+          }
+
+          void release(const entity_type& e)
+          {
+            entity_id_type entity_id = e.get_id();
+            component_id_type component_id = mapping_.get(entity_id);
+            if(valid_(component_id))
+            {
+              data_.release(component_id);
+              mapping_.set(entity_id, invalid_());
+              --size_;
+            }
+          }
+
+          void reserve(size_t n)
+          {
+            data_.reserve(n);
+          }
+
+          void reserve_mapping(entity_id_type max_entity_id)
+          {
+            mapping_.reserve(max_entity_id + 1);
+          }
+
+          void reserve_pages(entity_id_type max_entity_id)
+          {
+            mapping_.reserve_pages(max_entity_id + 1);
+          }
+
+          size_t compact(size_t budget)
+          {
+            return data_.compact(budget, [](wrapper_type& from, void* to)
+            {
+              wrapper_type::relocate(from, to);
+            }, [this](wrapper_type& wrapper, data_id_type, data_id_type to)
+            {
+              mapping_.at(wrapper.id()) = to;
+            });
+          }
+
+          void shrink_to_fit()
+          {
+            data_.shrink_to_fit();
+            mapping_.shrink_to_fit();
+          }
+
+          template <class F> void for_each(F && functor)
+          {
+            for(wrapper_type* wrapper : data_)
+            {
+              functor(wrapper->id(), wrapper->data());
+            }
+          }
+
+          /**
+           * call functor(entity_id_type) for each owner (functor may release the current one)
+           * and lookahead(entity_id_type) with the owner prefetch_distance positions ahead
+           */
+          template <class F, class L> void for_each_owner(F && functor, L && lookahead)
+          {
+            const size_t distance = prefetch_distance<component_type>::value;
+            auto         ahead    = data_.begin();
+            for(size_t i = 0 ; i < distance && ahead != data_.end() ; ++i)
+            {
+              ++ahead;
+            }
+
+            for(wrapper_type* wrapper : data_)
+            {
+              if(distance && ahead != data_.end())
+              {
+                // checked : functor may have released it
+                if(wrapper_type* next = *ahead)
+                {
+                  lookahead(next->id());
+                }
+                ++ahead;
+              }
+              functor(wrapper->id());
+            }
+          }
+
+          /**
+           * prefetch the component of entity_id (its mapping slot is loaded)
+           */
+          void prefetch(entity_id_type entity_id)
+          {
+            component_id_type component_id = mapping_.get(entity_id);
+            if(valid_(component_id))
+            {
+              detail::prefetch(data_.at(component_id));
+            }
+          }
+
+          size_t size() const
+          {
+            return size_;
+          }
+
+          size_t capacity() const
+          {
+            return data_.capacity();
+          }
+
+          component_type* get(const entity_type& e)
+          {
+            component_type* ret = nullptr;
+            entity_id_type entity_id = e.get_id();
+            component_id_type component_id = mapping_.get(entity_id);
+            if(valid_(component_id))
+            {
+              ret = &data_.get(component_id)->data();
+            }
+            return ret;
+          }
+
+          const component_type* get(const entity_type& e) const
+          {
+            const component_type* ret = nullptr;
+            entity_id_type entity_id = e.get_id();
+            component_id_type component_id = mapping_.get(entity_id);
+            if(valid_(component_id))
+            {
+              ret = &data_.get(component_id)->data();
+            }
+            return ret;
+          }
+
+          /**
+           * component of entity_id, the entity must have one (no check)
+           */
+          component_type* at(entity_id_type entity_id)
+          {
+            return &data_.at(mapping_.at(entity_id))->data();
+          }
+
+          /**
+           * rank of the component of entity_id in the pool order (max if none)
+           */
+          uint64_t position(entity_id_type entity_id) const
+          {
+            return mapping_.get(entity_id);
+          }
+
+          /**
+           * reorder the occupied slots by owner with less(entity_id_type, entity_id_type)
+           */
+          template <class L> bool sort(L && less, size_t budget, memory_resource* resource)
+          {
+            std::vector<data_id_type, resource_allocator<data_id_type>> slots{resource_allocator<data_id_type>(resource)};
+            slots.reserve(size_);
+            for(wrapper_type* wrapper : data_)
+            {
+              slots.push_back(mapping_.at(wrapper->id()));
+            }
+
+            return detail::sort_positions(slots.size(), [&](size_t i)
+            {
+              return data_.at(slots[i])->id();
+            }, [&](size_t i, size_t j)
+            {
+              swap_(slots[i], slots[j]);
+            }, less, budget, resource);
+          }
+
+        protected:
+          // id of wrapper is the owner entity
+          typedef wrapper<entity_id_type, component_type>                          wrapper_type;
+          typedef dynamic_segment<wrapper_type, segment_size<component_type>::value> data_type;
+          typedef typename data_type::id_type                                      data_id_type;
+          typedef detail::paged_map<component_id_type, std::numeric_limits<component_id_type>::max()> mapping_component_id_type;
+
+          void swap_(data_id_type a, data_id_type b)
+          {
+            typename std::aligned_storage<sizeof(wrapper_type), alignof(wrapper_type)>::type tmp;
+            wrapper_type* first  = data_.at(a);
+            wrapper_type* second = data_.at(b);
+            wrapper_type::relocate(*first, &tmp);
+            wrapper_type::relocate(*second, first);
+            wrapper_type::relocate(*(wrapper_type*)&tmp, second);
+            mapping_.at(first->id())  = a;
+            mapping_.at(second->id()) = b;
+          }
+
+          static constexpr bool valid_(component_id_type id)
+          {
+            return id != invalid_();
+          }
+
+          static constexpr component_id_type invalid_()
+          {
+            return std::numeric_limits<component_id_type>::max();
+          }
+
+        private:
+          data_type                 data_;
+          mapping_component_id_type mapping_;
+          size_t                    size_;
+      };
+
+      template <class Component> class component_manager<Component, sparse_set_storage>
+      {
+        public:
+          typedef Component component_type;
+
+          component_manager(memory_resource* resource)
+            : resource_(resource)
+            , data_(nullptr)
+            , size_(0)
+            , capacity_(0)
+            , owners_(owner_allocator_type(resource))
+            , mapping_(resource)
+          {
+          }
+
+          component_manager(const component_manager&) = delete;
+          component_manager& operator=(const component_manager&) = delete;
+
+          ~component_manager()
+          {
+            for(size_t i = 0 ; i < size_ ; ++i)
+            {
+              data_[i].~component_type();
+            }
+            deallocate_(data_, capacity_);
+          }
+
+          template <class ... ARGS> component_type* acquire(const entity_type&e, ARGS && ...args)
+          {
+            entity_id_type entity_id = e.get_id();
+
+            component_type* ret = nullptr;
+            if(size_ == capacity_)
+            {
+              // build the new one before moving the others : args may refer to one of them
+              size_t          capacity = std::max<size_t>(8, capacity_ * 2);
+              component_type* data     = allocate_(capacity);
+              ret = new(data + size_) component_type(std::forward<ARGS>(args)...);
+              move_(data, capacity);
+            }
+            else
+            {
+              ret = new(data_ + size_) component_type(std::forward<ARGS>(args)...);
+            }
+
+            mapping_.set(entity_id, (component_id_type)size_);
+            owners_.push_back(entity_id);
+            ++size_;
+            return ret;
+          }
+
+          void release(const entity_type& e)
+          {
+            entity_id_type entity_id = e.get_id();
+            component_id_type index = mapping_.get(entity_id);
+            if(valid_(index))
+            {
+              // swap and pop
+              size_t last = size_ - 1;
+              data_[index].~component_type();
+              if(index != last)
+              {
+                entity_system::relocate<component_type>::process(data_[last], data_ + index);
+                owners_[index]              = owners_[last];
+                mapping_.at(owners_[index]) = index;
+              }
+              owners_.pop_back();
+              mapping_.set(entity_id, invalid_());
+              --size_;
+            }
+          }
+
+          component_type* get(const entity_type& e)
+          {
+            entity_id_type entity_id = e.get_id();
+            component_id_type index = mapping_.get(entity_id);
+            return (valid_(index) ? data_ + index : nullptr);
+          }
+
+          const component_type* get(const entity_type& e) const
+          {
+            entity_id_type entity_id = e.get_id();
+            component_id_type index = mapping_.get(entity_id);
+            return (valid_(index) ? data_ + index : nullptr);
+          }
+
+          /**
+           * component of entity_id, the entity must have one (no check)
+           */
+          component_type* at(entity_id_type entity_id)
+          {
+            return data_ + mapping_.at(entity_id);
+          }
+
+          /**
+           * rank of the component of entity_id in the pool order (max if none)
+           */
+          uint64_t position(entity_id_type entity_id) const
+          {
+            return mapping_.get(entity_id);
+          }
+
+          /**
+           * reorder the components by owner with less(entity_id_type, entity_id_type)
+           */
+          template <class L> bool sort(L && less, size_t budget, memory_resource* resource)
+          {
+            return detail::sort_positions(size_, [&](size_t i)
+            {
+              return owners_[i];
+            }, [&](size_t i, size_t j)
+            {
+              typename std::aligned_storage<sizeof(component_type), alignof(component_type)>::type tmp;
+              entity_system::relocate<component_type>::process(data_[i], &tmp);
+              entity_system::relocate<component_type>::process(data_[j], data_ + i);
+              entity_system::relocate<component_type>::process(*(component_type*)&tmp, data_ + j);
+              swap_owners_(i, j);
+            }, less, budget, resource);
+          }
+
+          void reserve(size_t n)
+          {
+            if(n > capacity_)
+            {
+              move_(allocate_(n), n);
+            }
+            owners_.reserve(n);
+          }
+
+          void reserve_mapping(entity_id_type max_entity_id)
+          {
+            mapping_.reserve(max_entity_id + 1);
+          }
+
+          void reserve_pages(entity_id_type max_entity_id)
+          {
+            mapping_.reserve_pages(max_entity_id + 1);
+          }
+
+          /**
+           * always packed
+           */
+          size_t compact(size_t)
+          {
+            return 0;
+          }
+
+          void shrink_to_fit()
+          {
+            if(size_ < capacity_)
+            {
+              move_(size_ ? allocate_(size_) : nullptr, size_);
+            }
+            owners_.shrink_to_fit();
+            mapping_.shrink_to_fit();
+          }
+
+          template <class F> void for_each(F && functor)
+          {
+            for(size_t i = 0 ; i < size_ ; ++i)
+            {
+              functor(owners_[i], data_[i]);
+            }
+          }
+
+          /**
+           * call functor(entity_id_type) for each owner, last ones first (functor may release the current one)
+           * and lookahead(entity_id_type) with the owner prefetch_distance positions ahead
+           */
+          template <class F, class L> void for_each_owner(F && functor, L && lookahead)
+          {
+            const size_t distance = prefetch_distance<component_type>::value;
+            for(size_t i = size_ ; i-- > 0 ;)
+            {
+              if(distance && i >= distance)
+              {
+                lookahead(owners_[i - distance]);
+              }
+              functor(owners_[i]);
+              i = std::min(i, size_);
+            }
+          }
+
+          void prefetch(entity_id_type entity_id) const
+          {
+            if(const component_id_type* index = mapping_.find(entity_id))
+            {
+              detail::prefetch(index);
+            }
+          }
+
+          /**
+           * call functor(size, components, owners) once for the whole pool
+           */
+          template <class F> void for_each_chunk(F && functor)
+          {
+            if(size_)
+            {
+              functor(size_, data_, owners_.data());
+            }
+          }
+
+          size_t size() const
+          {
+            return size_;
+          }
+
+          size_t capacity() const
+          {
+            return capacity_;
+          }
+
+        protected:
+          typedef resource_allocator<entity_id_type>                        owner_allocator_type;
+          typedef std::vector<entity_id_type, owner_allocator_type>         owners_type;
+          typedef detail::paged_map<component_id_type, std::numeric_limits<component_id_type>::max()> mapping_component_id_type;
+
+          static constexpr bool valid_(component_id_type id)
+          {
+            return id != invalid_();
+          }
+
+          static constexpr component_id_type invalid_()
+          {
+            return std::numeric_limits<component_id_type>::max();
+          }
+
+          void swap_owners_(size_t i, size_t j)
+          {
+            std::swap(owners_[i], owners_[j]);
+            mapping_.at(owners_[i]) = (component_id_type)i;
+            mapping_.at(owners_[j]) = (component_id_type)j;
+          }
+
+          component_type* allocate_(size_t n)
+          {
+            return (component_type*)resource_->allocate(n * sizeof(component_type), alignof(component_type));
+          }
+
+          void deallocate_(component_type* data, size_t n)
+          {
+            if(data)
+            {
+              resource_->deallocate(data, n * sizeof(component_type), alignof(component_type));
+            }
+          }
+
+          /**
+           * relocate all components in data (of capacity) and release the previous buffer
+           */
+          void move_(component_type* data, size_t capacity)
+          {
+            for(size_t i = 0 ; i < size_ ; ++i)
+            {
+              entity_system::relocate<component_type>::process(data_[i], data + i);
+            }
+            deallocate_(data_, capacity_);
+            data_     = data;
+            capacity_ = capacity;
+          }
+
+        private:
+          memory_resource*          resource_;
+          component_type*           data_;
+          size_t                    size_;
+          size_t                    capacity_;
+          owners_type               owners_;
+          mapping_component_id_type mapping_;
+      };
+
+      template <class Component> class component_manager<Component, archetype_storage>
+      {
+        public:
+          typedef Component component_type;
+
+          component_manager(archetypes_type& archetypes)
+            : archetypes_(archetypes)
+          {
+          }
+
+          template <class ... ARGS> component_type* acquire(const entity_type&e, ARGS && ...args)
+          {
+            return archetypes_.template add<index_()>(e.get_id(), std::forward<ARGS>(args)...);
+          }
+
+          /**
+           * build the component of e in the row given by archetypes_type::add_row
+           */
+          template <class ... ARGS> component_type* build(const entity_type&e, ARGS && ...args)
+          {
+            return archetypes_.template build<index_()>(e.get_id(), std::forward<ARGS>(args)...);
+          }
+
+          void release(const entity_type& e)
+          {
+            archetypes_.remove(e.get_id(), index_());
+          }
+
+          component_type* get(const entity_type& e)
+          {
+            return archetypes_.template get<index_()>(e.get_id());
+          }
+
+          const component_type* get(const entity_type& e) const
+          {
+            return archetypes_.template get<index_()>(e.get_id());
+          }
+
+          /**
+           * component of entity_id, the entity must have one (no check)
+           */
+          component_type* at(entity_id_type entity_id)
+          {
+            return archetypes_.template at<index_()>(entity_id);
+          }
+
+          /**
+           * rank of the component of entity_id in the pool order (max if none)
+           */
+          uint64_t position(entity_id_type entity_id) const
+          {
+            return (archetypes_.template get<index_()>(entity_id) ? archetypes_.position(entity_id) : std::numeric_limits<uint64_t>::max());
+          }
 
-      entity_type* new_entity();
-      void    delete_entity(const entity_type& e);
+          /**
+           * chunks are allocated when an archetype is filled
+           */
+          void reserve(size_t)
+          {
+          }
 
-      template <class ... C, class F> void for_entities_with(F && functor)
-      {
-        component_mask_type mask = world_type::template get_component_mask<C...>();
-        for(entity_wrapper_type* wrapper : entities_)
-        {
-          entity_type& entity = wrapper->data();
-          if((entity.get_component_mask() & mask) == mask)
+          void reserve_mapping(entity_id_type max_entity_id)
           {
-            functor(entity);
+            archetypes_.reserve_locations(max_entity_id);
           }
-        }
-      }
 
-    protected:
-      entity_id_type get_id_(const entity_type& e);
-      template <class T> T*  get_component_(const entity_type& e);
-      template <class T, class ... ARGS> T* new_component_(const entity_type& e, ARGS && ... args);
-      template <class T> void delete_component_(const entity_type& e);
+          void reserve_pages(entity_id_type max_entity_id)
+          {
+            reserve_mapping(max_entity_id);
+          }
 
-      template <class I, class T> class wrapper
-      {
-        public:
-          typedef wrapper self_type;
-          typedef I       id_type;
-          typedef T       data_type;
+          /**
+           * always packed
+           */
+          size_t compact(size_t)
+          {
+            return 0;
+          }
 
-          template <class ... ARGS> wrapper(ARGS&& ... args)
-            : id_(0)
-            , data_(std::forward<ARGS>(args)...)
+          void shrink_to_fit()
           {
+            archetypes_.shrink_to_fit();
           }
 
-          static const self_type& to_wrapper(const data_type& data)
+          template <class F> void for_each(F && functor)
           {
-            return *(const self_type*)((const uint8_t*)&data - ptr_id_2_data_());
+            typename archetypes_type::mask_type mask;
+            mask[index_()] = true;
+            archetypes_.for_each(mask, [&](typename archetypes_type::archetype& a)
+            {
+              for(size_t chunk = 0 ; chunk < a.nb_chunks() ; ++chunk)
+              {
+                const entity_id_type* ids        = a.ids(chunk);
+                component_type*       components = a.template column<component_type>(chunk, index_());
+                size_t                size       = a.chunk_size(chunk);
+                for(size_t i = 0 ; i < size ; ++i)
+                {
+                  functor(ids[i], components[i]);
+                }
+              }
+            });
           }
 
-          data_type& data()
+          template <class F, class L> void for_each_owner(F && functor, L && lookahead)
           {
-            return data_;
+            archetypes_.for_each_id(index_(), functor, prefetch_distance<component_type>::value, lookahead);
           }
 
-          const data_type& data() const
+          void prefetch(entity_id_type entity_id) const
           {
-            return data_;
+            archetypes_.prefetch(entity_id);
           }
 
-          id_type& id()
+          size_t size() const
           {
-            return id_;
+            return archetypes_.size(index_());
           }
 
-          const id_type& id() const
+          /**
+           * nothing to reserve
+           */
+          size_t capacity() const
           {
-            return id_;
+            return std::numeric_limits<size_t>::max();
           }
 
         protected:
-          static constexpr size_t ptr_id_2_data_()
+          static constexpr size_t index_()
           {
-            wrapper* tmp = 0;
-            void* p1 = tmp;
-            void* p2 = &tmp->data_;
-            return ((size_t)p2-(size_t)p1);
+            return detail::components_index<component_type, std::tuple<Components...>>::value;
           }
 
         private:
-          id_type   id_;
-          data_type data_;
+          archetypes_type& archetypes_;
       };
 
-      template <class Component> class component_manager
+      template <class Component> class component_manager<Component, soa_storage>
       {
         public:
-          typedef Component component_type;
+          typedef Component                              component_type;
+          typedef soa_pointer<component_type>            pointer_type;
+          typedef soa_reference<component_type>          reference_type;
+          typedef detail::soa_traits<component_type>    traits_type;
+          typedef typename traits_type::pointers_type    columns_type;
+          typedef typename traits_type::indexes_type     indexes_type;
+
+          component_manager(memory_resource* resource)
+            : resource_(resource)
+            , size_(0)
+            , capacity_(0)
+            , owners_(owner_allocator_type(resource))
+            , mapping_(resource)
+          {
+          }
 
-          template <class ... ARGS> component_type* acquire(const entity_type&e, ARGS && ...args)
+          component_manager(const component_manager&) = delete;
+          component_manager& operator=(const component_manager&) = delete;
+
+          ~component_manager()
           {
-            entity_id_type entity_id = e.get_id();
-            if(entity_id + 1 > mapping_.size())
+            while(size_)
             {
-              mapping_.resize(entity_id + 1, invalid_());
+              destroy_(--size_, indexes_type());
             }
-            component_id_type& component_id = mapping_[entity_id];
+            move_(columns_type(), 0, indexes_type());
+          }
 
-            wrapper_type* wrapper = nullptr;
-            data_id_type  intern_component_id(0);
+          template <class ... ARGS> pointer_type acquire(const entity_type&e, ARGS && ...args)
+          {
+            entity_id_type entity_id = e.get_id();
 
-            std::tie(wrapper, intern_component_id) = data_.acquire(std::forward<ARGS>(args)...);
-            if(wrapper)
+            // build the value before growing : args may refer to a field of a component
+            component_type value(std::forward<ARGS>(args)...);
+            if(size_ == capacity_)
             {
-              component_id  = intern_component_id;
-              wrapper->id() = component_id;
+              size_t capacity = std::max<size_t>(8, capacity_ * 2);
+              move_(allocate_(capacity, indexes_type()), capacity, indexes_type());
             }
+            scatter_(value, indexes_type());
 
-            return (wrapper ? &wrapper->data() : nullptr);
+            mapping_.set(entity_id, (component_id_type)size_);
+            owners_.push_back(entity_id);
+            return at_(size_++);
           }
 
           void release(const entity_type& e)
           {
             entity_id_type entity_id = e.get_id();
-            if(entity_id < mapping_.size())
+            component_id_type index = mapping_.get(entity_id);
+            if(valid_(index))
             {
-              component_id_type& component_id = mapping_[entity_id];
-              if(valid_(component_id))
+              // swap and pop
+              size_t last = size_ - 1;
+              destroy_(index, indexes_type());
+              if(index != last)
               {
-                data_.release(component_id);
-                component_id = invalid_();
+                relocate_(last, index, indexes_type());
+                owners_[index]              = owners_[last];
+                mapping_.at(owners_[index]) = index;
               }
+              owners_.pop_back();
+              mapping_.set(entity_id, invalid_());
+              --size_;
             }
           }
 
-          component_type* get(const entity_type& e)
+          pointer_type get(const entity_type& e) const
           {
-            component_type* ret = nullptr;
             entity_id_type entity_id = e.get_id();
-            if(entity_id < mapping_.size())
+            component_id_type index = mapping_.get(entity_id);
+            return (valid_(index) ? at_(index) : pointer_type());
+          }
+
+          /**
+           * component of entity_id, the entity must have one (no check)
+           */
+          pointer_type at(entity_id_type entity_id) const
+          {
+            return at_(mapping_.at(entity_id));
+          }
+
+          /**
+           * rank of the component of entity_id in the pool order (max if none)
+           */
+          uint64_t position(entity_id_type entity_id) const
+          {
+            return mapping_.get(entity_id);
+          }
+
+          /**
+           * reorder the rows by owner with less(entity_id_type, entity_id_type)
+           */
+          template <class L> bool sort(L && less, size_t budget, memory_resource* resource)
+          {
+            return detail::sort_positions(size_, [&](size_t i)
             {
-              const component_id_type& component_id = mapping_[entity_id];
-              if(valid_(component_id))
-              {
-                ret = &data_.get(component_id)->data();
-              }
+              return owners_[i];
+            }, [&](size_t i, size_t j)
+            {
+              swap_(i, j, indexes_type());
+            }, less, budget, resource);
+          }
+
+          void reserve(size_t n)
+          {
+            if(n > capacity_)
+            {
+              move_(allocate_(n, indexes_type()), n, indexes_type());
             }
-            return ret;
+            owners_.reserve(n);
           }
 
-          const component_type* get(const entity_type& e) const
+          void reserve_mapping(entity_id_type max_entity_id)
           {
-            const component_type* ret = nullptr;
-            entity_id_type entity_id = e.get_id();
-            if(entity_id < mapping_.size())
+            mapping_.reserve(max_entity_id + 1);
+          }
+
+          void reserve_pages(entity_id_type max_entity_id)
+          {
+            mapping_.reserve_pages(max_entity_id + 1);
+          }
+
+          /**
+           * always packed
+           */
+          size_t compact(size_t)
+          {
+            return 0;
+          }
+
+          void shrink_to_fit()
+          {
+            if(size_ < capacity_)
             {
-              const component_id_type& component_id = mapping_[entity_id];
-              if(valid_(component_id))
+              move_(size_ ? allocate_(size_, indexes_type()) : columns_type(), size_, indexes_type());
+            }
+            owners_.shrink_to_fit();
+            mapping_.shrink_to_fit();
+          }
+
+          template <class F> void for_each(F && functor)
+          {
+            for(size_t i = 0 ; i < size_ ; ++i)
+            {
+              reference_type ref = *at_(i);
+              functor(owners_[i], ref);
+            }
+          }
+
+          soa_columns<component_type> columns() const
+          {
+            return soa_columns<component_type>(columns_, owners_.data(), size_);
+          }
+
+          /**
+           * call functor(entity_id_type) for each owner, last ones first (functor may release the current one)
+           * and lookahead(entity_id_type) with the owner prefetch_distance positions ahead
+           */
+          template <class F, class L> void for_each_owner(F && functor, L && lookahead)
+          {
+            const size_t distance = prefetch_distance<component_type>::value;
+            for(size_t i = size_ ; i-- > 0 ;)
+            {
+              if(distance && i >= distance)
               {
-                ret = &data_.get(component_id)->data();
+                lookahead(owners_[i - distance]);
               }
+              functor(owners_[i]);
+              i = std::min(i, size_);
             }
-            return ret;
+          }
+
+          void prefetch(entity_id_type entity_id) const
+          {
+            if(const component_id_type* index = mapping_.find(entity_id))
+            {
+              detail::prefetch(index);
+            }
+          }
+
+          size_t size() const
+          {
+            return size_;
+          }
+
+          size_t capacity() const
+          {
+            return capacity_;
           }
 
         protected:
-          typedef wrapper<component_id_type, component_type>  wrapper_type;
-          typedef dynamic_segment<wrapper_type, 8>            data_type;
-          typedef typename data_type::id_type                 data_id_type;
-          typedef std::vector<component_id_type>              mapping_component_id_type;
+          typedef resource_allocator<entity_id_type>                        owner_allocator_type;
+          typedef std::vector<entity_id_type, owner_allocator_type>         owners_type;
+          typedef detail::paged_map<component_id_type, std::numeric_limits<component_id_type>::max()> mapping_component_id_type;
+
+          template <size_t I> using field_type = typename traits_type::template field_type<I>;
 
           static constexpr bool valid_(component_id_type id)
           {
@@ -287,19 +2689,220 @@ namespace entity_system
             return std::numeric_limits<component_id_type>::max();
           }
 
+          pointer_type at_(size_t index) const
+          {
+            return pointer_type(detail::soa_offset(columns_, index, indexes_type()));
+          }
+
+          template <size_t ... I> columns_type allocate_(size_t n, std::index_sequence<I...>)
+          {
+            return columns_type((field_type<I>*)resource_->allocate(n * sizeof(field_type<I>), alignof(field_type<I>))...);
+          }
+
+          template <size_t ... I> void scatter_(component_type& value, std::index_sequence<I...>)
+          {
+            int tmp[] = {(new(std::get<I>(columns_) + size_) field_type<I>(std::move(value.*std::get<I>(soa_fields<component_type>::get()))), 0)...};
+            (void)tmp;
+          }
+
+          template <size_t ... I> void destroy_(size_t index, std::index_sequence<I...>)
+          {
+            int tmp[] = {(destroy_field_(std::get<I>(columns_) + index), 0)...};
+            (void)tmp;
+          }
+
+          template <class T> static void destroy_field_(T* field)
+          {
+            field->~T();
+          }
+
+          template <size_t ... I> void swap_(size_t i, size_t j, std::index_sequence<I...>)
+          {
+            using std::swap;
+            int tmp[] = {(swap(std::get<I>(columns_)[i], std::get<I>(columns_)[j]), 0)...};
+            (void)tmp;
+            std::swap(owners_[i], owners_[j]);
+            mapping_.at(owners_[i]) = (component_id_type)i;
+            mapping_.at(owners_[j]) = (component_id_type)j;
+          }
+
+          template <size_t ... I> void relocate_(size_t from, size_t to, std::index_sequence<I...>)
+          {
+            int tmp[] = {(entity_system::relocate<field_type<I>>::process(std::get<I>(columns_)[from], std::get<I>(columns_) + to), 0)...};
+            (void)tmp;
+          }
+
+          /**
+           * relocate all rows in columns (of capacity) and release the previous ones
+           */
+          template <size_t ... I> void move_(const columns_type& columns, size_t capacity, std::index_sequence<I...>)
+          {
+            int tmp[] = {(move_column_(std::get<I>(columns_), std::get<I>(columns)), 0)...};
+            (void)tmp;
+            columns_  = columns;
+            capacity_ = capacity;
+          }
+
+          template <class T> void move_column_(T* from, T* to)
+          {
+            for(size_t i = 0 ; i < size_ ; ++i)
+            {
+              entity_system::relocate<T>::process(from[i], to + i);
+            }
+            if(from)
+            {
+              resource_->deallocate(from, capacity_ * sizeof(T), alignof(T));
+            }
+          }
+
         private:
-          data_type                 data_;
+          memory_resource*          resource_;
+          columns_type              columns_;
+          size_t                    size_;
+          size_t                    capacity_;
+          owners_type               owners_;
           mapping_component_id_type mapping_;
       };
 
+      template <class Component> class component_manager<Component, tag_storage>
+      {
+        public:
+          typedef Component component_type;
+
+          static_assert(std::is_empty<component_type>::value, "tag_storage holds no value");
+
+          component_manager(memory_resource*)
+            : size_(0)
+          {
+          }
+
+          template <class ... ARGS> component_type* acquire(const entity_type&, ARGS && ...args)
+          {
+            // built for its arguments only, the mask bit is the component
+            component_type component(std::forward<ARGS>(args)...);
+            (void)component;
+            ++size_;
+            return &instance_();
+          }
+
+          void release(const entity_type&)
+          {
+            --size_;
+          }
+
+          component_type* get(const entity_type&)
+          {
+            return &instance_();
+          }
+
+          const component_type* get(const entity_type&) const
+          {
+            return &instance_();
+          }
+
+          component_type* at(entity_id_type)
+          {
+            return &instance_();
+          }
+
+          void reserve(size_t)
+          {
+          }
+
+          void reserve_mapping(entity_id_type)
+          {
+          }
+
+          void reserve_pages(entity_id_type)
+          {
+          }
+
+          size_t compact(size_t)
+          {
+            return 0;
+          }
+
+          void shrink_to_fit()
+          {
+          }
+
+          void prefetch(entity_id_type) const
+          {
+          }
+
+          /**
+           * number of entities with the tag
+           */
+          size_t size() const
+          {
+            return size_;
+          }
+
+          /**
+           * nothing to reserve
+           */
+          size_t capacity() const
+          {
+            return std::numeric_limits<size_t>::max();
+          }
+
+        protected:
+          static component_type& instance_()
+          {
+            static component_type instance;
+            return instance;
+          }
+
+        private:
+          size_t size_;
+      };
+
+      static constexpr size_t compact_batch_()
+      {
+        return 64;
+      }
+
+      static constexpr size_t cursor_batch_()
+      {
+        return 64;
+      }
+
       typedef wrapper<entity_id_type, entity_type>         entity_wrapper_type;
-      typedef dynamic_segment<entity_wrapper_type, 8>      entities_type;
+      typedef dynamic_segment<entity_wrapper_type, segment_size<entity_type>::value> entities_type;
       typedef std::tuple<component_manager<Components>...> components_type;
 
+      /**
+       * groups live in the memory of the world
+       */
+      struct group_deleter
+      {
+        void operator()(group* g) const
+        {
+          g->~group();
+          resource->deallocate(g, sizeof(group), alignof(group));
+        }
+
+        memory_resource* resource;
+      };
+      typedef std::unique_ptr<group, group_deleter>           group_ptr_type;
+      typedef resource_allocator<group_ptr_type>              groups_allocator_type;
+      typedef std::vector<group_ptr_type, groups_allocator_type> groups_type;
+
+      // generation of each entity slot : odd while the slot holds an entity
+      typedef resource_allocator<uint32_t>                      generations_allocator_type;
+      typedef std::vector<uint32_t, generations_allocator_type> generations_type;
+
     private:
-      world_type&     world_;
-      components_type components_;
-      entities_type   entities_;
+      world_type&      world_;
+      memory_resource* resource_;
+      archetypes_type  archetypes_;
+      components_type  components_;
+      groups_type      groups_;     // before entities_ : updated while entities are destroyed
+      masks_type       masks_;
+      generations_type generations_;
+      uint32_t         generations_floor_; // first generation of new slots, above the ones of shrunk slots
+      size_t           size_;
+      entities_type    entities_;
   };
 
   class system
@@ -314,8 +2917,10 @@ namespace entity_system
       typedef World                                world_type;
       typedef typename world_type::dispatcher_type dispatcher_type;
 
-      system_manager(world_type& w)
+      system_manager(world_type& w, memory_resource* resource = default_resource())
         : world_(w)
+        , dispatcher_(resource)
+        , systems_(systems_allocator_type(resource))
         , next_id_(0)
       {
       }
@@ -340,7 +2945,8 @@ namespace entity_system
       const dispatcher_type& get_dispatcher() const { return dispatcher_; }
 
     private:
-      typedef std::map<system_id_type, std::unique_ptr<system>> systems_type;
+      typedef resource_allocator<std::pair<const system_id_type, std::unique_ptr<system>>>                  systems_allocator_type;
+      typedef std::map<system_id_type, std::unique_ptr<system>, std::less<system_id_type>, systems_allocator_type> systems_type;
 
       world_type&      world_;
       dispatcher_type  dispatcher_;
@@ -356,7 +2962,12 @@ namespace entity_system
     return entity_manager_.get_id_(*this);
   }
 
-  template <class World> template <class T> T* entity<World>::get_component()
+  template <class World> entity_handle entity<World>::get_handle() const
+  {
+    return entity_manager_.get_handle(*this);
+  }
+
+  template <class World> template <class T> typename component_pointer<T>::type entity<World>::get_component()
   {    
     static const size_t pos = detail::components_index<T, components_type>::value;
     if(mask_component_[pos])
@@ -369,16 +2980,16 @@ namespace entity_system
     }
   }
 
-  template <class World> template <class T, class ... ARGS> T* entity<World>::new_component(ARGS && ... args)
+  template <class World> template <class T, class ... ARGS> typename component_pointer<T>::type entity<World>::new_component(ARGS && ... args)
   {
     static const size_t pos = detail::components_index<T, components_type>::value;
-    T* ret = nullptr;
+    typename component_pointer<T>::type ret = nullptr;
     if(!mask_component_[pos])
     {
       ret = entity_manager_.template new_component_<T>(*this, std::forward<ARGS>(args)...);
       if(ret)
       {
-        mask_component_[pos] = true;
+        entity_manager_.set_component_bit_(*this, pos, true);
       }
     }
     return ret;
@@ -390,12 +3001,12 @@ namespace entity_system
     if(mask_component_[pos])
     {
       entity_manager_.template delete_component_<T>(*this);
-      mask_component_[pos] = false;
+      entity_manager_.set_component_bit_(*this, pos, false);
     }
   }
 
   // entity_manager
-  template <class ... Events, class ... Components> entity_id_type entity_manager<world<std::tuple<Events...>, std::tuple<Components...>>>::get_id_(const entity_type& e)
+  template <class ... Events, class ... Components> entity_id_type entity_manager<world<std::tuple<Events...>, std::tuple<Components...>>>::get_id_(const entity_type& e) const
   {
     const entity_wrapper_type& wrapper =  entity_wrapper_type::to_wrapper(e);
     return wrapper.id();
@@ -405,22 +3016,103 @@ namespace entity_system
   {
     std::pair<entity_wrapper_type*, typename entities_type::id_type> ret = entities_.acquire(std::ref(*this));
     ret.first->id() = ret.second;
+
+    size_t index = entities_type::to_index(ret.second);
+    if(index >= masks_.size())
+    {
+      masks_.resize(std::max(index + 1, entities_.capacity()));
+    }
+    if(index >= generations_.size())
+    {
+      generations_.resize(masks_.size(), generations_floor_);
+    }
+    ++generations_[index];
+    ++size_;
     return &ret.first->data();
   }
 
+  template <class ... Events, class ... Components> template <class ... C, class ... I> void entity_manager<world<std::tuple<Events...>, std::tuple<Components...>>>::create_batch(size_t n, I && ... init)
+  {
+    static_assert(sizeof...(C) == sizeof...(I), "one initializer per component");
+    if(!n)
+    {
+      return;
+    }
+
+    reserve_entities_(n);
+    entity_id_type max_entity_id = entities_type::to_id(entities_.capacity() - 1);
+    int tmp[] = {(reserve_more_<C>(n), std::get<component_manager<C>>(components_).reserve_mapping(max_entity_id), 0)...};
+    (void)tmp;
+
+    typename archetypes_type::archetype_id_type archetype = archetypes_.archetype_of(query_mask_<C...>() & archetype_mask_());
+    for(size_t i = 0 ; i < n ; ++i)
+    {
+      entity_type& e = *new_entity();
+      if(archetype)
+      {
+        archetypes_.add_row(e.get_id(), archetype);
+      }
+
+      mask_words_type words = {};
+      int built[] = {(batch_component_<C>(e, detail::batch_value(init, i, 0), words), 0)...};
+      (void)built;
+      masks_.set(entity_index_(e), words);
+      update_groups_(e, component_mask_type());
+    }
+  }
+
   template <class ... Events, class ... Components> void entity_manager<world<std::tuple<Events...>, std::tuple<Components...>>>::delete_entity(const entity_type& e)
   {
+    ++generations_[entity_index_(e)];
+    --size_;
     entities_.release(get_id_(e));
   }
 
-  template <class ... Events, class ... Components> template <class T> T* entity_manager<world<std::tuple<Events...>, std::tuple<Components...>>>::get_component_(const entity_type& e)
+  template <class ... Events, class ... Components> void entity_manager<world<std::tuple<Events...>, std::tuple<Components...>>>::reserve(size_t n)
+  {
+    if(n)
+    {
+      entities_.reserve(n);
+      masks_.reserve(n);
+      generations_.reserve(n);
+      entity_id_type max_entity_id = entities_type::to_id(n - 1);
+      int tmp[] = {(std::get<component_manager<Components>>(components_).reserve_mapping(max_entity_id), 0)...};
+      (void)tmp;
+    }
+  }
+
+  template <class ... Events, class ... Components> void entity_manager<world<std::tuple<Events...>, std::tuple<Components...>>>::shrink_to_fit()
+  {
+    entities_.shrink_to_fit();
+    masks_.resize(std::min(masks_.size(), entities_.capacity()));
+    masks_.shrink_to_fit();
+    // slots dropped are free (even generation) : handles on them stay stale when they come back
+    for(size_t index = std::min(masks_.size(), generations_.size()) ; index < generations_.size() ; ++index)
+    {
+      generations_floor_ = std::max(generations_floor_, generations_[index]);
+    }
+    generations_.resize(std::min(masks_.size(), generations_.size()));
+    generations_.shrink_to_fit();
+    int tmp[] = {(std::get<component_manager<Components>>(components_).shrink_to_fit(), 0)...};
+    (void)tmp;
+  }
+
+  template <class ... Events, class ... Components> size_t entity_manager<world<std::tuple<Events...>, std::tuple<Components...>>>::compact(size_t budget)
+  {
+    size_t ret = 0;
+    int tmp[] = {(ret += std::get<component_manager<Components>>(components_).compact(budget - ret), 0)...};
+    (void)tmp;
+    return ret;
+  }
+
+  template <class ... Events, class ... Components> template <class T> typename component_pointer<T>::type entity_manager<world<std::tuple<Events...>, std::tuple<Components...>>>::get_component_(const entity_type& e)
   {
     typedef component_manager<T> manager_type;
     manager_type& manager = std::get<manager_type>(components_);    
     return manager.get(e);
   }
 
-  template <class ... Events, class ... Components> template <class T, class ... ARGS> T* entity_manager<world<std::tuple<Events...>, std::tuple<Components...>>>::new_component_(const entity_type& e, ARGS && ... args)
+  template <class ... Events, class ... Components> template <class T, class ... ARGS> typename component_pointer<T>::type entity_manager<world<std::tuple<Events...>, std::tuple<Components...>>>::new_component_(const entity_type& e, ARGS && ... args)
   {
     typedef component_manager<T> manager_type;
     manager_type& manager = std::get<manager_type>(components_);
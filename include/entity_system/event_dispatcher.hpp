@@ -2,6 +2,7 @@
 # define ENTITY_SYSTEM_EVENT_DISPATCHER_HPP
 
 # include <entity_system/forwards.hpp>
+# include <entity_system/memory_resource.hpp>
 
 # include <memory>
 # include <vector>
@@ -37,6 +38,10 @@ namespace entity_system
 
   template <class O> class event_dispatcher<O>
   {
+    protected:
+      event_dispatcher(memory_resource*)
+      {
+      }
   };
 
   template <class O, class E> class event_dispatcher<O, E>
@@ -44,8 +49,15 @@ namespace entity_system
     protected:
       typedef E                              event_type;
       typedef O                              owner_type;
-      typedef listener<event_type>           listener_type;
-      typedef std::vector<listener_type*>    listeners_type;
+      typedef listener<event_type>                                  listener_type;
+      typedef resource_allocator<listener_type*>                    listeners_allocator_type;
+      typedef std::vector<listener_type*, listeners_allocator_type> listeners_type;
+
+      event_dispatcher(memory_resource* resource)
+        : free_handler_(free_handler_allocator_type(resource))
+        , listeners_(listeners_allocator_type(resource))
+      {
+      }
 
       void push_(const event_type& event)
       {
@@ -67,6 +79,18 @@ namespace entity_system
         listeners_.push_back(&l);
       }
 
+      /**
+       * give back memory of unused handlers
+       */
+      void release_handlers_()
+      {
+        for(data_event_handler_impl_type* mem : free_handler_)
+        {
+          resource_().deallocate(mem, sizeof(data_event_handler_impl_type), alignof(data_event_handler_impl_type));
+        }
+        free_handler_.clear();
+      }
+
       void disconnect_(listener_type& l)
       {
         bool found = false;
@@ -112,7 +136,7 @@ namespace entity_system
 
           virtual void dispose() override
           {
-            owner_.free_handler_.emplace_back((data_event_handler_impl_type*)this);
+            owner_.free_handler_.push_back((data_event_handler_impl_type*)this);
             this->~event_handler_impl();
           }
 
@@ -123,30 +147,43 @@ namespace entity_system
 
       template <class ... ARGS> auto make_handler_(ARGS&&... args)
       {
-        event_handler_deleter::ptr_type               ret;
-        std::unique_ptr<data_event_handler_impl_type> mem;
+        event_handler_deleter::ptr_type ret;
+        data_event_handler_impl_type*   mem;
         if(free_handler_.empty())
         {
-          mem.reset(new data_event_handler_impl_type);
+          mem = (data_event_handler_impl_type*)resource_().allocate(sizeof(data_event_handler_impl_type), alignof(data_event_handler_impl_type));
         }
         else
         {
-          auto& handler = free_handler_.back();
-          mem = std::move(handler);
+          mem = free_handler_.back();
           free_handler_.pop_back();
         }
-        ret.reset(new(mem.release()) event_handler_impl(*this,  std::forward<ARGS>(args)...));
+        ret.reset(new(mem) event_handler_impl(*this,  std::forward<ARGS>(args)...));
         return ret;
       }      
 
+      memory_resource& resource_()
+      {
+        return *static_cast<owner_type*>(this)->resource_;
+      }
+
       typedef typename std::aligned_storage<sizeof(event_handler_impl), alignof(event_handler_impl)>::type  data_event_handler_impl_type;
 
-      std::vector<std::unique_ptr<data_event_handler_impl_type>> free_handler_;
-      listeners_type listeners_;
+      typedef resource_allocator<data_event_handler_impl_type*>                  free_handler_allocator_type;
+      typedef std::vector<data_event_handler_impl_type*, free_handler_allocator_type> free_handler_type;
+
+      free_handler_type free_handler_;
+      listeners_type    listeners_;
   };
 
   template <class O, class E0, class ... Es> class event_dispatcher<O, E0, Es...> : public event_dispatcher<O, E0>, public event_dispatcher<O, Es...>
   {
+    protected:
+      event_dispatcher(memory_resource* resource)
+        : event_dispatcher<O, E0>(resource)
+        , event_dispatcher<O, Es...>(resource)
+      {
+      }
   };
 
   template <class... Events> class dispatcher : public event_dispatcher<dispatcher<Events...>, Events...>
@@ -155,14 +192,24 @@ namespace entity_system
       typedef dispatcher self_type;
       template <class, class ...> friend class event_dispatcher;
 
-      dispatcher()
-        : event_idx_(0)
+      dispatcher(memory_resource* resource = default_resource())
+        : event_dispatcher<self_type, Events...>(resource)
+        , resource_(resource)
+        , events_(events_allocator_type(resource))
+        , event_idx_(0)
       {
       }
 
       ~dispatcher()
       {
         events_.clear();
+        int tmp[] = {0, (event_dispatcher<self_type, Events>::release_handlers_(), 0)...};
+        (void)tmp;
+      }
+
+      memory_resource* get_memory_resource() const
+      {
+        return resource_;
       }
 
       size_t dispatch(int count = -1)
@@ -208,8 +255,12 @@ namespace entity_system
       }
 
     private:
-      std::vector<event_handler_deleter::ptr_type> events_;
-      size_t event_idx_;
+      typedef resource_allocator<event_handler_deleter::ptr_type>                  events_allocator_type;
+      typedef std::vector<event_handler_deleter::ptr_type, events_allocator_type> events_type;
+
+      memory_resource* resource_;
+      events_type      events_;
+      size_t           event_idx_;
   };
 }
 
@@ -10,6 +10,9 @@ namespace entity_system
   typedef uint32_t system_id_type;
   typedef uint32_t entity_id_type;
 
+  class memory_resource;
+  template <class T> class resource_allocator;
+
   template <class E> class listener;
   class event_handler;
   class event_handler_deleter;
@@ -19,6 +22,8 @@ namespace entity_system
   template <class T, size_t S> class segment;
   template <class T, size_t S> class dynamic_segment;
 
+  template <class T> struct segment_size;
+
   template <class...> class world;
   template<class> class entity;
   template<class> class entity_manager;
@@ -0,0 +1,298 @@
+#ifndef ENTITY_SYSTEM_MEMORY_RESOURCE_HPP
+# define ENTITY_SYSTEM_MEMORY_RESOURCE_HPP
+
+# include <entity_system/forwards.hpp>
+
+# include <new>
+# include <cstddef>
+# include <algorithm>
+
+# if defined(__unix__) || defined(__APPLE__)
+#  include <sys/mman.h>
+#  include <unistd.h>
+#  define ENTITY_SYSTEM_HAS_MMAP 1
+# endif
+
+namespace entity_system
+{
+  /**
+   * source of memory of a world (entities, components, event handlers)
+   */
+  class memory_resource
+  {
+    public:
+      virtual ~memory_resource() {}
+
+      virtual void* allocate(size_t bytes, size_t alignment) = 0;
+      virtual void  deallocate(void* p, size_t bytes, size_t alignment) = 0;
+
+      /**
+       * hint : bytes at offset of block (returned by allocate(block_bytes, alignment)) are unused,
+       * their content may be dropped (and read back as zero)
+       */
+      virtual void discard(void* /*block*/, size_t /*block_bytes*/, size_t /*alignment*/, size_t /*offset*/, size_t /*bytes*/)
+      {
+      }
+  };
+
+  /**
+   * global operator new/delete
+   */
+  class new_delete_resource : public memory_resource
+  {
+    public:
+      virtual void* allocate(size_t bytes, size_t alignment) override
+      {
+        if(alignment <= alignof(std::max_align_t))
+        {
+          return ::operator new(bytes);
+        }
+
+        // over aligned : keep the real pointer just before the returned block
+        uint8_t* raw = (uint8_t*)::operator new(bytes + alignment + sizeof(void*));
+        size_t   p   = ((size_t)raw + sizeof(void*) + alignment - 1) & ~(alignment - 1);
+        ((void**)p)[-1] = raw;
+        return (void*)p;
+      }
+
+      virtual void deallocate(void* p, size_t, size_t alignment) override
+      {
+        if(alignment <= alignof(std::max_align_t))
+        {
+          ::operator delete(p);
+        }
+        else
+        {
+          ::operator delete(((void**)p)[-1]);
+        }
+      }
+  };
+
+  inline memory_resource* default_resource()
+  {
+    static new_delete_resource resource;
+    return &resource;
+  }
+
+  /**
+   * forward to upstream and keep count of memory used
+   */
+  class counting_resource : public memory_resource
+  {
+    public:
+      counting_resource(memory_resource* upstream = default_resource())
+        : upstream_(upstream)
+        , bytes_in_use_(0)
+        , peak_bytes_(0)
+        , nb_allocations_(0)
+      {
+      }
+
+      virtual void* allocate(size_t bytes, size_t alignment) override
+      {
+        void* ret = upstream_->allocate(bytes, alignment);
+        bytes_in_use_ += bytes;
+        peak_bytes_    = std::max(peak_bytes_, bytes_in_use_);
+        ++nb_allocations_;
+        return ret;
+      }
+
+      virtual void deallocate(void* p, size_t bytes, size_t alignment) override
+      {
+        upstream_->deallocate(p, bytes, alignment);
+        bytes_in_use_ -= bytes;
+      }
+
+      virtual void discard(void* block, size_t block_bytes, size_t alignment, size_t offset, size_t bytes) override
+      {
+        upstream_->discard(block, block_bytes, alignment, offset, bytes);
+      }
+
+      size_t bytes_in_use() const { return bytes_in_use_; }
+      size_t peak_bytes() const { return peak_bytes_; }
+      size_t nb_allocations() const { return nb_allocations_; }
+      memory_resource* upstream() const { return upstream_; }
+
+    private:
+      memory_resource* upstream_;
+      size_t           bytes_in_use_;
+      size_t           peak_bytes_;
+      size_t           nb_allocations_;
+  };
+
+# ifdef ENTITY_SYSTEM_HAS_MMAP
+  /**
+   * map large blocks directly from the system (small ones go to upstream)
+   *
+   * with huge_pages, blocks of at least huge_page_size are aligned on huge_page_size
+   * and flagged for transparent huge pages (madvise MADV_HUGEPAGE)
+   *
+   * throw std::bad_alloc if the system refuses the mapping (like new_delete_resource)
+   */
+  class mmap_resource : public memory_resource
+  {
+    public:
+      static constexpr size_t huge_page_size = 2 * 1024 * 1024;
+
+      mmap_resource(bool huge_pages = true, size_t threshold = 64 * 1024, memory_resource* upstream = default_resource())
+        : huge_pages_(huge_pages)
+        , threshold_(threshold)
+        , upstream_(upstream)
+      {
+      }
+
+      virtual void* allocate(size_t bytes, size_t alignment) override
+      {
+        if(bytes < threshold_ || alignment > page_size_())
+        {
+          return upstream_->allocate(bytes, alignment);
+        }
+
+        size_t size = map_size_(bytes);
+        void*  ret  = nullptr;
+        if(use_huge_pages_(bytes))
+        {
+          // map more to align on huge page then unmap both ends
+          size_t total = size + huge_page_size;
+          uint8_t* raw = (uint8_t*)map_(total);
+          if(raw)
+          {
+            uint8_t* aligned = (uint8_t*)(((size_t)raw + huge_page_size - 1) & ~(huge_page_size - 1));
+            if(aligned != raw)
+            {
+              ::munmap(raw, aligned - raw);
+            }
+            if((size_t)(raw + total - (aligned + size)))
+            {
+              ::munmap(aligned + size, raw + total - (aligned + size));
+            }
+#  ifdef MADV_HUGEPAGE
+            ::madvise(aligned, size, MADV_HUGEPAGE);
+#  endif
+            ret = aligned;
+          }
+        }
+        else
+        {
+          ret = map_(size);
+        }
+
+        if(!ret)
+        {
+          throw std::bad_alloc();
+        }
+        return ret;
+      }
+
+      virtual void deallocate(void* p, size_t bytes, size_t alignment) override
+      {
+        if(bytes < threshold_ || alignment > page_size_())
+        {
+          upstream_->deallocate(p, bytes, alignment);
+        }
+        else
+        {
+          ::munmap(p, map_size_(bytes));
+        }
+      }
+
+      /**
+       * give back to the system the whole pages of the range
+       */
+      virtual void discard(void* block, size_t block_bytes, size_t alignment, size_t offset, size_t bytes) override
+      {
+        if(block_bytes < threshold_ || alignment > page_size_())
+        {
+          upstream_->discard(block, block_bytes, alignment, offset, bytes);
+        }
+        else
+        {
+          size_t begin = ((size_t)block + offset + page_size_() - 1) & ~(page_size_() - 1);
+          size_t end   = ((size_t)block + offset + bytes) & ~(page_size_() - 1);
+          if(begin < end)
+          {
+            ::madvise((void*)begin, end - begin, MADV_DONTNEED);
+          }
+        }
+      }
+
+    protected:
+      static size_t page_size_()
+      {
+        static size_t size = (size_t)::sysconf(_SC_PAGESIZE);
+        return size;
+      }
+
+      size_t map_size_(size_t bytes) const
+      {
+        size_t align = (use_huge_pages_(bytes) ? huge_page_size : page_size_());
+        return (bytes + align - 1) & ~(align - 1);
+      }
+
+      bool use_huge_pages_(size_t bytes) const
+      {
+        return huge_pages_ && bytes >= huge_page_size;
+      }
+
+      static void* map_(size_t size)
+      {
+        void* ret = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        return (ret == MAP_FAILED ? nullptr : ret);
+      }
+
+    private:
+      bool             huge_pages_;
+      size_t           threshold_;
+      memory_resource* upstream_;
+  };
+# endif
+
+  /**
+   * standard allocator on top of a memory_resource
+   */
+  template <class T> class resource_allocator
+  {
+    public:
+      typedef T value_type;
+
+      resource_allocator(memory_resource* resource = default_resource())
+        : resource_(resource)
+      {
+      }
+
+      template <class U> resource_allocator(const resource_allocator<U>& other)
+        : resource_(other.resource())
+      {
+      }
+
+      T* allocate(size_t n)
+      {
+        return (T*)resource_->allocate(n * sizeof(T), alignof(T));
+      }
+
+      void deallocate(T* p, size_t n)
+      {
+        resource_->deallocate(p, n * sizeof(T), alignof(T));
+      }
+
+      memory_resource* resource() const
+      {
+        return resource_;
+      }
+
+      template <class U> bool operator==(const resource_allocator<U>& other) const
+      {
+        return resource_ == other.resource();
+      }
+
+      template <class U> bool operator!=(const resource_allocator<U>& other) const
+      {
+        return resource_ != other.resource();
+      }
+
+    private:
+      memory_resource* resource_;
+  };
+}
+
+#endif
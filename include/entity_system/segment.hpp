@@ -2,12 +2,15 @@
 # define ENTITY_SYSTEM_SEGMENT_HPP
 
 # include <entity_system/forwards.hpp>
+# include <entity_system/bits.hpp>
+# include <entity_system/memory_resource.hpp>
 
 # include <array>
 # include <vector>
 # include <type_traits>
 # include <utility>
 # include <memory>
+# include <algorithm>
 
 namespace entity_system
 {
@@ -35,57 +38,168 @@ namespace entity_system
 
         static pos_type find_first_bit(flag_type num)
         {
-          pos_type ret = 0;
-          static uint8_t nibblebits[] = {0, 1, 2, 1, 3, 1, 2, 1, 4, 1, 2, 1, 3, 1, 2, 1};
-          for(;num != 0;ret += 4)
-          {
-            uint8_t t = num & 0x0f;
-            if(t)
-            {
-              ret += nibblebits[t];
-              break;
-            }
-            num >>= 4;
-          }
-          return ret;
+          return (num ? (pos_type)(ctz(num) + 1) : 0);
         }
 
         static flag_type get_bit(flag_type mask)
         {
-          static flag_type hitbits[] = {0, 1, 2, 1, 4, 1, 2, 1, 8, 1, 2, 1, 4, 1, 2, 1};
-          for(char i = 0 ;mask; ++i)
+          return mask & (flag_type)(~mask + 1);
+        }
+
+        static size_t count_bit(flag_type mask)
+        {
+          return popcount(mask);
+        }
+
+        /**
+         * mask of all position strictly after pos (pos is 1-based, 0 means before the first one)
+         */
+        static flag_type after(pos_type pos)
+        {
+          return (pos < bits ? (flag_type)(all() << pos) : none());
+        }
+
+        static bool test(const flag_type& flag, pos_type pos)
+        {
+          return flag & pos_2_mask(pos);
+        }
+
+        static void set(flag_type& flag, pos_type pos)
+        {
+          flag = flag | pos_2_mask(pos);
+        }
+
+        static void reset(flag_type& flag, pos_type pos)
+        {
+          flag = flag & ~pos_2_mask(pos);
+        }
+
+        /**
+         * first position strictly after pos with a reset bit (0 if none)
+         */
+        static pos_type find_next_reset(const flag_type& flag, pos_type pos)
+        {
+          return find_first_bit((flag_type)~flag & after(pos));
+        }
+
+        static constexpr size_t bits = sizeof(flag_type) * 8;
+    };
+
+    /**
+     * occupancy bitmap of several 64 bits words (segment larger than 64)
+     */
+    template <size_t N> struct segment_opt_array
+    {
+        typedef std::array<uint64_t, N> flag_type;
+        typedef uint16_t                pos_type;
+
+        static flag_type all()
+        {
+          flag_type ret;
+          ret.fill((uint64_t)-1);
+          return ret;
+        }
+
+        static flag_type none()
+        {
+          flag_type ret;
+          ret.fill(0);
+          return ret;
+        }
+
+        static pos_type find_first_bit(const flag_type& flag)
+        {
+          for(size_t i = 0 ; i < N ; ++i)
           {
-            unsigned char t = mask & 0x0f;
-            if(t)
+            if(flag[i])
             {
-              return hitbits[t] << 4*i;
+              return (pos_type)(i * 64 + ctz(flag[i]) + 1);
             }
-            mask >>= 4;
           }
           return 0;
         }
 
-        static size_t count_bit(flag_type mask)
+        static size_t count_bit(const flag_type& flag)
         {
-          static uint8_t nibblebits[] = {0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4};
-          std::size_t ret = 0;
-          while(mask != 0)
+          size_t ret = 0;
+          for(uint64_t word : flag)
           {
-            uint8_t t = mask & 0x0f;
-            ret += nibblebits[t];
-            mask >>= 4;
+            ret += popcount(word);
           }
           return ret;
         }
+
+        static bool test(const flag_type& flag, pos_type pos)
+        {
+          --pos;
+          return (flag[pos / 64] >> (pos % 64)) & 1;
+        }
+
+        static void set(flag_type& flag, pos_type pos)
+        {
+          --pos;
+          flag[pos / 64] |= (uint64_t)1 << (pos % 64);
+        }
+
+        static void reset(flag_type& flag, pos_type pos)
+        {
+          --pos;
+          flag[pos / 64] &= ~((uint64_t)1 << (pos % 64));
+        }
+
+        static pos_type find_next_reset(const flag_type& flag, pos_type pos)
+        {
+          size_t i = pos / 64;
+          if(i >= N)
+          {
+            return 0;
+          }
+          uint64_t word = ~flag[i] & ((uint64_t)-1 << (pos % 64));
+          while(!word)
+          {
+            if(++i == N)
+            {
+              return 0;
+            }
+            word = ~flag[i];
+          }
+          return (pos_type)(i * 64 + ctz(word) + 1);
+        }
     };
 
-    template <size_t> struct segment_opt;
+    template <size_t S> struct segment_opt : public segment_opt_array<S / 64>
+    {
+      static_assert(S % 64 == 0,  "segment larger than 64 must be a multiple of 64");
+      static_assert(S <= 32768,   "segment size is limited to 32768");
+    };
     template <> struct segment_opt<8> : public segment_opt_tmpl<uint8_t> {};
     template <> struct segment_opt<16> : public segment_opt_tmpl<uint16_t> {};
     template <> struct segment_opt<32> : public segment_opt_tmpl<uint32_t> {};
     template <> struct segment_opt<64> : public segment_opt_tmpl<uint64_t> {};
+
+    /**
+     * number of bits to store value
+     */
+    constexpr uint32_t bits_for(size_t value)
+    {
+      return (value ? 1 + bits_for(value >> 1) : 0);
+    }
   }
 
+  /**
+   * move an object to uninitialized memory and destroy the source (used by compaction)
+   *
+   * specialize it for types which can not simply be moved, e.g. registered elsewhere by address
+   */
+  template <class T> struct relocate
+  {
+    static void process(T& from, void* to)
+    {
+      new(to) T(std::move(from));
+      from.~T();
+    }
+  };
+
   template <class Seg> class segment_iterator
   {
     public:
@@ -165,47 +279,76 @@ namespace entity_system
 
       void clear()
       {
-        for(id_type id = 1; id < max_pos(); ++id)
+        for(id_type id = next(0); id < max_pos(); id = next(id))
         {
-          if(has(id))
-          {
-            release(id);
-          }
+          release(id);
         }
       }
 
       template <class ... ARGS> std::pair<type*, id_type> acquire(ARGS && ... args)
+      {
+        return acquire_with([&](void* data)
+        {
+          new(data) type(std::forward<ARGS>(args)...);
+        });
+      }
+
+      /**
+       * take a free slot, construct(void*) must build the object in it
+       */
+      template <class F> std::pair<type*, id_type> acquire_with(F && construct)
       {
         id_type pos = opt_type::find_first_bit(flag_);
         type*   val = nullptr;
         if(pos)
         {
           void* data = &data_[pos - 1];
-          flag_      = flag_ & ~opt_type::pos_2_mask(pos);
-          new(data) type(std::forward<ARGS>(args)...);
+          opt_type::reset(flag_, pos);
+          construct(data);
           val        = (type*)data;
         }
         return std::make_pair(val, pos);
       }
 
+      /**
+       * free the slot without destroying the object (it was relocated)
+       */
+      void forget(id_type id)
+      {
+        if(has(id))
+        {
+          opt_type::set(flag_, id);
+        }
+      }
+
       void release(id_type id)
       {
         type* val = get(id);
         if(val)
         {
           val->~type();
-          flag_ = flag_ | opt_type::pos_2_mask(id);
+          opt_type::set(flag_, id);
         }
       }
 
       bool full() const
       {
-        return opt_type::count_bit(flag_) == 0;
+        return flag_ == opt_type::none();
+      }
+
+      bool empty() const
+      {
+        return flag_ == opt_type::all();
+      }
+
+      size_t count() const
+      {
+        return S - opt_type::count_bit(flag_);
       }
 
       bool has(id_type id) const
       {
-        return (id > 0) && (id <= S) && (opt_type::pos_2_mask(id) & ~flag_);
+        return (id > 0) && (id <= S) && !opt_type::test(flag_, id);
       }
 
       type* get(id_type id)
@@ -213,6 +356,14 @@ namespace entity_system
         return (has(id) ? (type*)&data_[id - 1] : nullptr);
       }
 
+      /**
+       * object at id, id must be acquired (no check)
+       */
+      type* at(id_type id)
+      {
+        return (type*)&data_[id - 1];
+      }
+
       const type* get(id_type id) const
       {
         return (has(id) ? (const type*)&data_[id - 1] : nullptr);
@@ -252,14 +403,8 @@ namespace entity_system
       {
         if(pos < max_pos())
         {
-          ++pos;
-          for(;pos < max_pos(); ++pos)
-          {
-            if(has(pos))
-            {
-              break;
-            }
-          }
+          id_type found = opt_type::find_next_reset(flag_, pos);
+          pos = (found ? found : max_pos());
         }
         return pos;
       }
@@ -275,6 +420,12 @@ namespace entity_system
     public:
       typedef T                type;
       typedef segment<type, S> segment_type;
+
+      /**
+       * bits used by the position inside a segment (0 .. S + 1)
+       */
+      static constexpr uint32_t id_bits = detail::bits_for(S + 1);
+
       struct id_type
       {
         id_type(uint32_t val)
@@ -298,8 +449,8 @@ namespace entity_system
           uint32_t int_value;
           struct
           {
-            uint32_t seg_id : 8;
-            uint32_t seg_nb : 24;
+            uint32_t seg_id : id_bits;
+            uint32_t seg_nb : 32 - id_bits;
           };
         };
       };
@@ -308,57 +459,225 @@ namespace entity_system
 
       static const size_t size;
 
-      dynamic_segment()
+      dynamic_segment(memory_resource* resource = default_resource())
+        : resource_(resource)
+        , segments_(segment_allocator_type(resource))
+        , blocks_(block_allocator_type(resource))
+        , capacity_(0)
+        , reserved_(0)
+        , available_(resource)
       {
       }
 
+      dynamic_segment(const dynamic_segment&) = delete;
+      dynamic_segment& operator=(const dynamic_segment&) = delete;
+
       ~dynamic_segment()
       {
         clear();
+        for(const block_type& block : blocks_)
+        {
+          resource_->deallocate(block.data, block.count * sizeof(segment_type), alignof(segment_type));
+        }
       }
 
+      /**
+       * destroy all objects, memory is kept (cf capacity)
+       */
       void clear()
       {
+        for(segment_type* segment : segments_)
+        {
+          if(segment)
+          {
+            segment->~segment_type();
+          }
+        }
         segments_.clear();
+        available_.resize(0);
+        available_.resize(capacity_);
       }
 
-      template <class ... ARGS> std::pair<type*, id_type> acquire(ARGS && ... args)
+      /**
+       * preallocate (in one contiguous block) the memory to store n objects
+       */
+      void reserve(size_t n)
       {
-        segment_type* segment = nullptr;
-        id_type id(0);
-        for(auto& seg : segments_)
+        size_t count = (n + S - 1) / S;
+        if(count > capacity_)
         {
-          if(!seg->full())
+          grow_(count - capacity_);
+        }
+        reserved_ = std::max(reserved_, count);
+      }
+
+      /**
+       * give back memory of unused blocks, and pages covered by empty segments (if resource supports it)
+       * reserved capacity is released too
+       */
+      void shrink_to_fit()
+      {
+        reserved_ = 0;
+        while(!blocks_.empty() && blocks_.back().first >= segments_.size())
+        {
+          free_block_();
+        }
+
+        for(const block_type& block : blocks_)
+        {
+          size_t end = std::min(block.first + block.count, segments_.size());
+          for(size_t nb = block.first ; nb < end ; ++nb)
           {
-            segment = seg.get();
-            break;
+            if(empty_(nb))
+            {
+              size_t last = nb + 1;
+              while(last < end && empty_(last))
+              {
+                ++last;
+              }
+              discard_(block, nb, last);
+              nb = last;
+            }
           }
-          ++id.seg_nb;
         }
 
-        if(!segment)
+        // slots never built (or trimmed) at the end of the last block
+        if(!blocks_.empty())
         {
-          std::unique_ptr<segment_type> seg = std::make_unique<segment_type>();
-          segment = seg.get();
-          segments_.push_back(std::move(seg));
+          discard_(blocks_.back(), segments_.size(), capacity_);
         }
 
-        type* data;
-        typename segment_type::id_type seg_id;
-        std::tie(data, seg_id) = segment->acquire(std::forward<ARGS>(args)...);
-        id.seg_id = seg_id;
+        segments_.shrink_to_fit();
+        blocks_.shrink_to_fit();
+      }
 
-        return std::make_pair(data, id);
+      size_t capacity() const
+      {
+        return capacity_ * S;
+      }
+
+      memory_resource* get_memory_resource() const
+      {
+        return resource_;
+      }
+
+      /**
+       * dense index (0 .. capacity) <-> id
+       */
+      static id_type to_id(size_t index)
+      {
+        return id_type(index % S + 1, index / S);
+      }
+
+      static size_t to_index(id_type id)
+      {
+        return id.seg_nb * S + id.seg_id - 1;
+      }
+
+      template <class ... ARGS> std::pair<type*, id_type> acquire(ARGS && ... args)
+      {
+        return acquire_with([&](void* data)
+        {
+          new(data) type(std::forward<ARGS>(args)...);
+        });
+      }
+
+      /**
+       * take a free slot, construct(void*) must build the object in it
+       */
+      template <class F> std::pair<type*, id_type> acquire_with(F && construct)
+      {
+        size_t nb = available_.find_first();
+        if(nb == detail::hierarchical_bitmap::npos())
+        {
+          nb = segments_.size();
+          if(nb == capacity_)
+          {
+            grow_(std::max<size_t>(1, capacity_));
+          }
+          segments_.push_back(new(slot_(nb)) segment_type());
+          available_.set(nb);
+        }
+        return acquire_in_(nb, std::forward<F>(construct));
       }
 
       void release(id_type id)
       {
-        segments_[id.seg_nb]->release(id.seg_id);
+        if(has(id))
+        {
+          segments_[id.seg_nb]->release(id.seg_id);
+          available_.set(id.seg_nb);
+          if(id.seg_nb + 1u == segments_.size() && segments_.back()->empty())
+          {
+            trim_();
+          }
+        }
+      }
+
+      /**
+       * free the slot without destroying the object (it was relocated)
+       */
+      void forget(id_type id)
+      {
+        if(has(id))
+        {
+          segments_[id.seg_nb]->forget(id.seg_id);
+          available_.set(id.seg_nb);
+          if(id.seg_nb + 1u == segments_.size() && segments_.back()->empty())
+          {
+            trim_();
+          }
+        }
+      }
+
+      /**
+       * move objects of the last segment into free slots of previous ones, so the pool
+       * uses fewer segments. At most budget objects are moved, return the number of moved objects.
+       *
+       * relocate(type& from, void* to) builds the object at to and destroys from (default : relocate<type>)
+       * moved(type& object, id_type from, id_type to) is called after each move
+       */
+      template <class R, class M> size_t compact(size_t budget, R && relocate, M && moved)
+      {
+        size_t ret = 0;
+        for(; ret < budget ; ++ret)
+        {
+          size_t nb = available_.find_first();
+          if(nb == detail::hierarchical_bitmap::npos() || nb + 1 >= segments_.size())
+          {
+            break;
+          }
+
+          id_type from(segments_.back()->next(0), segments_.size() - 1);
+          type&   object = *segments_.back()->get(from.seg_id);
+          std::pair<type*, id_type> to = acquire_in_(nb, [&](void* data)
+          {
+            relocate(object, data);
+          });
+          forget(from);
+          moved(*to.first, from, to.second);
+        }
+        return ret;
+      }
+
+      template <class M> size_t compact(size_t budget, M && moved)
+      {
+        return compact(budget, [](type& from, void* to)
+        {
+          entity_system::relocate<type>::process(from, to);
+        }, std::forward<M>(moved));
+      }
+
+      size_t compact(size_t budget)
+      {
+        return compact(budget, [](type&, id_type, id_type)
+        {
+        });
       }
 
       bool has(id_type id) const
       {
-        return (id.seg_nb < segments_.size()) && (segments_[id.seg_nb]->has(id.seg_id));
+        return (id.seg_nb < segments_.size()) && segments_[id.seg_nb] && (segments_[id.seg_nb]->has(id.seg_id));
       }
 
       type* get(id_type id)
@@ -366,6 +685,14 @@ namespace entity_system
         return (has(id) ? segments_[id.seg_nb]->get(id.seg_id) : nullptr);
       }
 
+      /**
+       * object at id, id must be acquired (no check)
+       */
+      type* at(id_type id)
+      {
+        return segments_[id.seg_nb]->at(id.seg_id);
+      }
+
       const type* get(id_type id) const
       {
         return (has(id) ? segments_[id.seg_nb]->get(id.seg_id) : nullptr);
@@ -404,35 +731,147 @@ namespace entity_system
       id_type next(id_type pos) const
       {
         id_type end = end_pos_();
-        if(pos != end)
+        if(pos != end && pos.seg_nb < segments_.size())
         {
-          do
+          size_t nb = pos.seg_nb;
+          typename segment_type::id_type id = (segments_[nb] ? segments_[nb]->next(pos.seg_id) : segment_type::max_pos());
+          // an empty segment answers max_pos() after scanning its occupancy words (one for S <= 64, S / 64 otherwise),
+          // a discarded one without any scan
+          while(id == segment_type::max_pos() && nb + 1 < segments_.size())
           {
-            pos.seg_id = segments_[pos.seg_nb]->next(pos.seg_id);
-            if(pos.seg_id == segment_type::max_pos())
-            {
-              pos.seg_id = 0;
-              if(segments_.size() == pos.seg_nb + 1u)
-              {
-                pos = end;
-                break;
-              }
-              else
-              {
-                ++pos.seg_nb;
-              }
-            }
-          } while(!has(pos));
+            ++nb;
+            id = (segments_[nb] ? segments_[nb]->next(0) : segment_type::max_pos());
+          }
+          pos = (id == segment_type::max_pos() ? end : id_type(id, nb));
+        }
+        else
+        {
+          pos = end;
         }
         return pos;
       }
 
     protected:
-      typedef std::vector<std::unique_ptr<segment_type>> segments_type;
+      typedef resource_allocator<segment_type*>                  segment_allocator_type;
+      typedef std::vector<segment_type*, segment_allocator_type> segments_type;
+
+      /**
+       * contiguous memory for count segments, segments are built on demand
+       */
+      struct block_type
+      {
+        segment_type* data;
+        size_t        first;
+        size_t        count;
+      };
+      typedef resource_allocator<block_type>                block_allocator_type;
+      typedef std::vector<block_type, block_allocator_type> blocks_type;
+
+      void grow_(size_t count)
+      {
+        segment_type* data = (segment_type*)resource_->allocate(count * sizeof(segment_type), alignof(segment_type));
+        blocks_.push_back(block_type{data, capacity_, count});
+        capacity_ += count;
+        segments_.reserve(capacity_);
+        available_.resize(capacity_);
+      }
+
+      template <class F> std::pair<type*, id_type> acquire_in_(size_t nb, F && construct)
+      {
+        segment_type* segment = segments_[nb];
+        if(!segment)
+        {
+          segment = segments_[nb] = new(slot_(nb)) segment_type();
+        }
+        id_type id(0);
+        id.seg_nb = nb;
+
+        type* data;
+        typename segment_type::id_type seg_id;
+        std::tie(data, seg_id) = segment->acquire_with(std::forward<F>(construct));
+        id.seg_id = seg_id;
+        if(segment->full())
+        {
+          available_.reset(nb);
+        }
+
+        return std::make_pair(data, id);
+      }
+
+      void free_block_()
+      {
+        const block_type& block = blocks_.back();
+        resource_->deallocate(block.data, block.count * sizeof(segment_type), alignof(segment_type));
+        capacity_ = block.first;
+        blocks_.pop_back();
+        available_.resize(capacity_);
+      }
+
+      /**
+       * drop trailing empty segments, and the last block when it is far from used (not under reserved)
+       */
+      void trim_()
+      {
+        while(!segments_.empty() && empty_(segments_.size() - 1))
+        {
+          available_.reset(segments_.size() - 1);
+          if(segments_.back())
+          {
+            segments_.back()->~segment_type();
+          }
+          segments_.pop_back();
+        }
+
+        while(blocks_.size() > 1 && blocks_.back().first >= 2 * segments_.size() && blocks_.back().first >= reserved_)
+        {
+          free_block_();
+        }
+      }
+
+      /**
+       * empty or not built (discarded)
+       */
+      bool empty_(size_t nb) const
+      {
+        return !segments_[nb] || segments_[nb]->empty();
+      }
+
+      /**
+       * slots [first, last) of block are empty or not built : discard their pages, the built ones
+       * are destroyed and will be built again by acquire (touching the pages would fault them back in)
+       */
+      void discard_(const block_type& block, size_t first, size_t last)
+      {
+        if(first < last)
+        {
+          for(size_t nb = first ; nb < std::min(last, segments_.size()) ; ++nb)
+          {
+            if(segments_[nb])
+            {
+              segments_[nb]->~segment_type();
+              segments_[nb] = nullptr;
+            }
+          }
+          resource_->discard(block.data, block.count * sizeof(segment_type), alignof(segment_type), (first - block.first) * sizeof(segment_type), (last - first) * sizeof(segment_type));
+        }
+      }
+
+      segment_type* slot_(size_t nb) const
+      {
+        auto it = blocks_.rbegin();
+        while(it->first > nb)
+        {
+          ++it;
+        }
+        return it->data + (nb - it->first);
+      }
 
+      /**
+       * does not depend on the number of segments : iteration stays valid when segments are added or trimmed
+       */
       id_type end_pos_() const
       {
-        return id_type(S + 1, (segments_.empty() ? 0 : segments_.size() - 1));
+        return id_type(S + 1, 0);
       }
 
       id_type begin_pos_() const
@@ -441,7 +880,12 @@ namespace entity_system
       }
 
     private:
-      segments_type segments_;
+      memory_resource*            resource_;
+      segments_type               segments_;
+      blocks_type                 blocks_;
+      size_t                      capacity_;
+      size_t                      reserved_;
+      detail::hierarchical_bitmap available_;
   };
   template <class T, size_t S> const size_t dynamic_segment<T, S>::size = S;
 }
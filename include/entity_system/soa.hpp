@@ -0,0 +1,213 @@
+#ifndef ENTITY_SYSTEM_SOA_HPP
+# define ENTITY_SYSTEM_SOA_HPP
+
+# include <entity_system/forwards.hpp>
+
+# include <tuple>
+# include <utility>
+# include <type_traits>
+
+namespace entity_system
+{
+  /**
+   * fields of a component stored as struct of arrays (one column per field)
+   *
+   * template <> struct soa_fields<position>
+   * {
+   *   static auto get() { return std::make_tuple(&position::x, &position::y); }
+   * };
+   */
+  template <class T> struct soa_fields;
+
+  namespace detail
+  {
+    template <class M> struct member_of;
+
+    template <class T, class F> struct member_of<F T::*>
+    {
+      typedef F type;
+    };
+
+    template <class T, class Members> struct soa_traits_impl;
+
+    template <class T, class ... Members> struct soa_traits_impl<T, std::tuple<Members...>>
+    {
+      typedef std::tuple<Members...>                               members_type;
+      typedef std::tuple<typename member_of<Members>::type*...>    pointers_type;
+      typedef std::index_sequence_for<Members...>                  indexes_type;
+
+      static constexpr size_t size = sizeof...(Members);
+
+      template <size_t I> using field_type = typename member_of<typename std::tuple_element<I, members_type>::type>::type;
+    };
+
+    template <class T> struct soa_traits : soa_traits_impl<T, decltype(soa_fields<T>::get())>
+    {
+    };
+
+    /**
+     * pointers on fields of row index of columns
+     */
+    template <class Pointers, size_t ... I> Pointers soa_offset(const Pointers& columns, size_t index, std::index_sequence<I...>)
+    {
+      return Pointers((std::get<I>(columns) + index)...);
+    }
+  }
+
+  /**
+   * reference on a component stored as struct of arrays
+   */
+  template <class T> class soa_reference
+  {
+    public:
+      typedef detail::soa_traits<T>                 traits_type;
+      typedef typename traits_type::pointers_type   pointers_type;
+
+      template <size_t I> using field_type = typename traits_type::template field_type<I>;
+
+      soa_reference(const pointers_type& fields)
+        : fields_(fields)
+      {
+      }
+
+      template <size_t I> field_type<I>& get() const
+      {
+        return *std::get<I>(fields_);
+      }
+
+      /**
+       * store all fields of value
+       */
+      const soa_reference& operator=(const T& value) const
+      {
+        store_(value, typename traits_type::indexes_type());
+        return *this;
+      }
+
+      /**
+       * gather fields in a T (default constructible)
+       */
+      T load() const
+      {
+        T ret;
+        load_(ret, typename traits_type::indexes_type());
+        return ret;
+      }
+
+      const pointers_type& fields() const
+      {
+        return fields_;
+      }
+
+    protected:
+      template <size_t ... I> void store_(const T& value, std::index_sequence<I...>) const
+      {
+        int tmp[] = {(*std::get<I>(fields_) = value.*std::get<I>(soa_fields<T>::get()), 0)...};
+        (void)tmp;
+      }
+
+      template <size_t ... I> void load_(T& value, std::index_sequence<I...>) const
+      {
+        int tmp[] = {(value.*std::get<I>(soa_fields<T>::get()) = *std::get<I>(fields_), 0)...};
+        (void)tmp;
+      }
+
+    private:
+      pointers_type fields_;
+  };
+
+  /**
+   * nullable pointer on a component stored as struct of arrays (returned by get_component/new_component)
+   */
+  template <class T> class soa_pointer
+  {
+    public:
+      typedef soa_reference<T>                     reference_type;
+      typedef typename reference_type::pointers_type pointers_type;
+
+      soa_pointer(std::nullptr_t = nullptr)
+        : ref_(pointers_type())
+      {
+      }
+
+      explicit soa_pointer(const pointers_type& fields)
+        : ref_(fields)
+      {
+      }
+
+      const reference_type* operator->() const
+      {
+        return &ref_;
+      }
+
+      const reference_type& operator*() const
+      {
+        return ref_;
+      }
+
+      explicit operator bool() const
+      {
+        return std::get<0>(ref_.fields()) != nullptr;
+      }
+
+      bool operator==(const soa_pointer& other) const
+      {
+        return std::get<0>(ref_.fields()) == std::get<0>(other.ref_.fields());
+      }
+
+      bool operator!=(const soa_pointer& other) const
+      {
+        return !(*this == other);
+      }
+
+    private:
+      reference_type ref_;
+  };
+
+  /**
+   * columns of a struct of arrays pool : size() rows, column<I>() is the array of field I,
+   * ids() the owner entities
+   */
+  template <class T> class soa_columns
+  {
+    public:
+      typedef detail::soa_traits<T>                 traits_type;
+      typedef typename traits_type::pointers_type   pointers_type;
+
+      template <size_t I> using field_type = typename traits_type::template field_type<I>;
+
+      soa_columns(const pointers_type& columns, const entity_id_type* ids, size_t size)
+        : columns_(columns)
+        , ids_(ids)
+        , size_(size)
+      {
+      }
+
+      size_t size() const
+      {
+        return size_;
+      }
+
+      template <size_t I> field_type<I>* column() const
+      {
+        return std::get<I>(columns_);
+      }
+
+      const entity_id_type* ids() const
+      {
+        return ids_;
+      }
+
+      soa_reference<T> operator[](size_t index) const
+      {
+        return soa_reference<T>(detail::soa_offset(columns_, index, typename traits_type::indexes_type()));
+      }
+
+    private:
+      pointers_type         columns_;
+      const entity_id_type* ids_;
+      size_t                size_;
+  };
+}
+
+#endif
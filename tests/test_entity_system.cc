@@ -5,6 +5,8 @@
 #include <boost/test/unit_test.hpp>
 
 #include <set>
+#include <thread>
+#include <algorithm>
 #include <entity_system/entity_system.hpp>
 
 namespace
@@ -41,6 +43,226 @@ namespace
   class e2 {};
 
   typedef entity_system::world<std::tuple<e1, e2>, std::tuple<position, life>> world_type;
+
+  // pools with segments wider than 64 slots
+  class energy
+  {
+    public:
+      energy(uint16_t init)
+        : init(init)
+      {
+      }
+
+      uint16_t init;
+  };
+
+  typedef entity_system::world<std::tuple<e1>, std::tuple<position, energy>> wide_segment_world_type;
+
+  // component with a custom relocation
+  uint32_t counter_relocate = 0;
+  class tracked
+  {
+    public:
+      tracked(uint32_t v)
+        : value(v)
+        , self(this)
+      {
+      }
+
+      uint32_t value;
+      tracked* self;
+  };
+
+  typedef entity_system::world<std::tuple<e1>, std::tuple<position, tracked>> tracked_world_type;
+
+  // component in a sparse set
+  class velocity
+  {
+    public:
+      velocity(int16_t x, int16_t y)
+        : x(x)
+        , y(y)
+      {
+      }
+
+      int16_t x;
+      int16_t y;
+  };
+
+  typedef entity_system::world<std::tuple<e1>, std::tuple<position, velocity>> sparse_world_type;
+
+  // components stored by archetype
+  int32_t counter_health = 0;
+  class health
+  {
+    public:
+      health(uint32_t v)
+        : value(v)
+      {
+        ++counter_health;
+      }
+
+      health(const health& other)
+        : value(other.value)
+      {
+        ++counter_health;
+      }
+
+      health(health&& other)
+        : value(other.value)
+      {
+        ++counter_health;
+      }
+
+      ~health()
+      {
+        --counter_health;
+      }
+
+      uint32_t value;
+  };
+
+  class mass
+  {
+    public:
+      mass(double v)
+        : value(v)
+      {
+      }
+
+      double value;
+  };
+
+  typedef entity_system::world<std::tuple<e1>, std::tuple<position, health, mass>> archetype_world_type;
+
+  // third archetype component : scans may create archetypes
+  class charge
+  {
+    public:
+      charge(int32_t v)
+        : value(v)
+      {
+      }
+
+      int32_t value;
+  };
+
+  typedef entity_system::world<std::tuple<e1>, std::tuple<health, mass, charge>> charge_world_type;
+
+  // component stored as struct of arrays
+  class body
+  {
+    public:
+      body()
+        : x(0)
+        , y(0)
+        , vx(0)
+        , vy(0)
+      {
+      }
+
+      body(float x, float y, float vx, float vy)
+        : x(x)
+        , y(y)
+        , vx(vx)
+        , vy(vy)
+      {
+      }
+
+      float x;
+      float y;
+      float vx;
+      float vy;
+  };
+
+  typedef entity_system::world<std::tuple<e1>, std::tuple<position, body>> soa_world_type;
+
+  // components without storage
+  class sleeping {};
+  class marked {};
+
+  typedef entity_system::world<std::tuple<e1>, std::tuple<position, velocity, sleeping, marked>> tag_world_type;
+
+  // world with a component mask of several words
+  template <size_t I> class flag
+  {
+  };
+
+  template <class S> struct flags;
+  template <size_t ... I> struct flags<std::index_sequence<I...>>
+  {
+    typedef std::tuple<flag<I>...> type;
+  };
+
+  typedef entity_system::world<std::tuple<e1>, flags<std::make_index_sequence<70>>::type> wide_world_type;
+}
+
+namespace entity_system
+{
+  template <> struct component_storage<velocity>
+  {
+    typedef sparse_set_storage type;
+  };
+
+  template <> struct component_storage<health>
+  {
+    typedef archetype_storage type;
+  };
+
+  template <> struct component_storage<mass>
+  {
+    typedef archetype_storage type;
+  };
+
+  template <> struct component_storage<charge>
+  {
+    typedef archetype_storage type;
+  };
+
+  template <> struct component_storage<sleeping>
+  {
+    typedef tag_storage type;
+  };
+
+  template <> struct component_storage<marked>
+  {
+    typedef tag_storage type;
+  };
+
+  template <> struct component_storage<body>
+  {
+    typedef soa_storage type;
+  };
+
+  template <> struct soa_fields<body>
+  {
+    static auto get()
+    {
+      return std::make_tuple(&body::x, &body::y, &body::vx, &body::vy);
+    }
+  };
+
+  template <> struct relocate<tracked>
+  {
+    static void process(tracked& from, void* to)
+    {
+      tracked* ret = new(to) tracked(from.value);
+      ret->self    = ret;
+      from.~tracked();
+      ++counter_relocate;
+    }
+  };
+}
+
+namespace entity_system
+{
+  template <> struct segment_size<energy>                           : std::integral_constant<size_t, 256>  {};
+  template <> struct segment_size<entity<wide_segment_world_type>> : std::integral_constant<size_t, 1024> {};
+
+  // queries walking these pools prefetch ahead
+  template <> struct prefetch_distance<life>     : std::integral_constant<size_t, 2> {};
+  template <> struct prefetch_distance<velocity> : std::integral_constant<size_t, 4> {};
+  template <> struct prefetch_distance<health>   : std::integral_constant<size_t, 4> {};
 }
 
 BOOST_AUTO_TEST_CASE( entity_system_01 )
@@ -157,3 +379,1493 @@ BOOST_AUTO_TEST_CASE( entity_system_02 )
     BOOST_CHECK_EQUAL(len, 0u);
   }
 }
+
+BOOST_AUTO_TEST_CASE( entity_system_03 )
+{
+  wide_segment_world_type world;
+
+  auto& em = world.get_entity_manager();
+  std::vector<wide_segment_world_type::entity_type*> entities;
+  for(uint16_t i = 0 ; i < 3000 ; ++i)
+  {
+    auto entity = em.new_entity();
+    entity->new_component<position>(i, i);
+    if(i % 3 == 0)
+    {
+      entity->new_component<energy>(i);
+    }
+    entities.push_back(entity);
+  }
+
+  for(uint16_t i = 0 ; i < 3000 ; ++i)
+  {
+    BOOST_REQUIRE(entities[i]->get_component<position>() != nullptr);
+    BOOST_CHECK_EQUAL(entities[i]->get_component<position>()->x, i);
+    BOOST_CHECK_EQUAL(entities[i]->get_component<energy>() != nullptr, i % 3 == 0);
+  }
+
+  size_t len = 0;
+  em.for_entities_with<position, energy>( [&]( auto& e)
+  {
+    BOOST_CHECK_EQUAL(e.template get_component<energy>()->init % 3, 0);
+    ++len;
+  });
+  BOOST_CHECK_EQUAL(len, 1000u);
+}
+
+BOOST_AUTO_TEST_CASE( entity_system_reserve )
+{
+  world_type world;
+
+  auto& em = world.get_entity_manager();
+  em.reserve(100);
+  em.reserve<position>(100);
+
+  std::vector<world_type::entity_type*> entities;
+  std::vector<position*>                positions;
+  for(uint16_t i = 0 ; i < 100 ; ++i)
+  {
+    auto entity = em.new_entity();
+    positions.push_back(entity->new_component<position>(i, i));
+    entities.push_back(entity);
+  }
+
+  // same block
+  for(size_t i = 1 ; i < 100 ; ++i)
+  {
+    BOOST_CHECK(positions[i] > positions[i - 1]);
+    BOOST_CHECK(entities[i] > entities[i - 1]);
+  }
+
+  // no allocation after reserve, sparse mapping included
+  entity_system::counting_resource resource;
+  sparse_world_type sparse_world(&resource);
+  auto& sparse_em = sparse_world.get_entity_manager();
+  sparse_em.reserve(5000);
+  sparse_em.reserve<position>(5000);
+  sparse_em.reserve<velocity>(5000);
+  size_t nb_allocations = resource.nb_allocations();
+
+  std::vector<sparse_world_type::entity_type*> sparse_entities;
+  for(int16_t i = 0 ; i < 5000 ; ++i)
+  {
+    auto entity = sparse_em.new_entity();
+    entity->new_component<position>(i, i);
+    entity->new_component<velocity>(i, i);
+    sparse_entities.push_back(entity);
+  }
+  for(sparse_world_type::entity_type* e : sparse_entities)
+  {
+    e->delete_component<velocity>();
+  }
+  sparse_entities.back()->new_component<velocity>((int16_t)1, (int16_t)1);
+  BOOST_CHECK_EQUAL(resource.nb_allocations(), nb_allocations);
+}
+
+BOOST_AUTO_TEST_CASE( entity_system_compact )
+{
+  tracked_world_type world;
+
+  auto& em = world.get_entity_manager();
+  std::vector<tracked_world_type::entity_type*> entities;
+  for(uint16_t i = 0 ; i < 200 ; ++i)
+  {
+    auto entity = em.new_entity();
+    entity->new_component<position>(i, i);
+    entity->new_component<tracked>(i);
+    entities.push_back(entity);
+  }
+
+  // keep 1 on 10, components are spread over all segments
+  std::vector<tracked_world_type::entity_type*> keep;
+  for(uint16_t i = 0 ; i < 200 ; ++i)
+  {
+    if(i % 10)
+    {
+      entities[i]->delete_component<position>();
+      entities[i]->delete_component<tracked>();
+    }
+    else
+    {
+      keep.push_back(entities[i]);
+    }
+  }
+
+  // object budget
+  counter_relocate = 0;
+  size_t moved = em.compact<tracked>(5);
+  BOOST_CHECK_EQUAL(moved, 5u);
+  BOOST_CHECK_EQUAL(counter_relocate, 5u);
+
+  // time budget
+  moved = em.compact(std::chrono::milliseconds(100));
+  BOOST_CHECK(moved > 0u);
+  BOOST_CHECK_EQUAL(em.compact(1000), 0u);
+
+  for(size_t i = 0 ; i < keep.size() ; ++i)
+  {
+    position* p = keep[i]->get_component<position>();
+    tracked*  t = keep[i]->get_component<tracked>();
+    BOOST_REQUIRE(p != nullptr);
+    BOOST_REQUIRE(t != nullptr);
+    BOOST_CHECK_EQUAL(p->x, i * 10);
+    BOOST_CHECK_EQUAL(t->value, i * 10);
+    BOOST_CHECK(t->self == t);
+  }
+
+  size_t len = 0;
+  em.for_entities_with<position, tracked>( [&]( auto&)
+  {
+    ++len;
+  });
+  BOOST_CHECK_EQUAL(len, 20u);
+
+  // new component after compaction
+  BOOST_CHECK(entities[1]->new_component<tracked>(1) != nullptr);
+  BOOST_CHECK_EQUAL(keep[19]->get_component<tracked>()->value, 190u);
+}
+
+BOOST_AUTO_TEST_CASE( entity_system_sparse_set )
+{
+  sparse_world_type world;
+
+  auto& em = world.get_entity_manager();
+  std::vector<sparse_world_type::entity_type*> entities;
+  for(int16_t i = 0 ; i < 100 ; ++i)
+  {
+    auto entity = em.new_entity();
+    entity->new_component<position>(i, i);
+    velocity* v = entity->new_component<velocity>(i, -i);
+    BOOST_REQUIRE(v != nullptr);
+    BOOST_CHECK(entity->new_component<velocity>(0, 0) == nullptr);
+    entities.push_back(entity);
+  }
+
+  // packed
+  velocity* first = entities[0]->get_component<velocity>();
+  for(int16_t i = 0 ; i < 100 ; ++i)
+  {
+    BOOST_CHECK(entities[i]->get_component<velocity>() == first + i);
+  }
+
+  // swap and pop
+  entities[10]->delete_component<velocity>();
+  BOOST_CHECK(entities[10]->get_component<velocity>() == nullptr);
+  BOOST_CHECK(entities[99]->get_component<velocity>() == first + 10);
+  BOOST_CHECK_EQUAL(entities[99]->get_component<velocity>()->x, 99);
+
+  em.delete_entity(*entities[0]);
+  BOOST_CHECK(entities[98]->get_component<velocity>() == first);
+
+  for(int16_t i = 1 ; i < 100 ; ++i)
+  {
+    velocity* v = entities[i]->get_component<velocity>();
+    if(i == 10)
+    {
+      BOOST_CHECK(v == nullptr);
+    }
+    else
+    {
+      BOOST_REQUIRE(v != nullptr);
+      BOOST_CHECK_EQUAL(v->x, i);
+      BOOST_CHECK_EQUAL(v->y, -i);
+    }
+  }
+
+  // linear scan
+  size_t len = 0;
+  em.for_each_component<velocity>([&](sparse_world_type::entity_type& e, velocity& v)
+  {
+    BOOST_CHECK(e.get_component<velocity>() == &v);
+    BOOST_CHECK_EQUAL(e.get_component<position>()->x, v.x);
+    ++len;
+  });
+  BOOST_CHECK_EQUAL(len, 98u);
+
+  len = 0;
+  em.for_entities_with<position, velocity>([&](auto&)
+  {
+    ++len;
+  });
+  BOOST_CHECK_EQUAL(len, 98u);
+
+  // reserve / shrink keep values
+  em.reserve<velocity>(1000);
+  BOOST_CHECK_EQUAL(entities[50]->get_component<velocity>()->x, 50);
+  em.shrink_to_fit();
+  BOOST_CHECK_EQUAL(entities[50]->get_component<velocity>()->x, 50);
+  BOOST_CHECK(entities[1]->new_component<position>(0, 0) == nullptr);
+}
+
+BOOST_AUTO_TEST_CASE( entity_system_archetype )
+{
+  counter_health = 0;
+  {
+    archetype_world_type world;
+
+    auto& em = world.get_entity_manager();
+    std::vector<archetype_world_type::entity_type*> entities;
+    for(uint16_t i = 0 ; i < 3000 ; ++i)
+    {
+      auto entity = em.new_entity();
+      entity->new_component<position>(i, i);
+      BOOST_REQUIRE(entity->new_component<health>(i) != nullptr);
+      BOOST_CHECK(entity->new_component<health>(0) == nullptr);
+      if(i % 3 == 0)
+      {
+        // the entity moves to the archetype {health, mass}
+        entity->new_component<mass>(i * 0.5);
+      }
+      entities.push_back(entity);
+    }
+    BOOST_CHECK_EQUAL(counter_health, 3000);
+
+    for(uint16_t i = 0 ; i < 3000 ; ++i)
+    {
+      BOOST_REQUIRE(entities[i]->get_component<health>() != nullptr);
+      BOOST_CHECK_EQUAL(entities[i]->get_component<health>()->value, i);
+      BOOST_CHECK_EQUAL(entities[i]->get_component<mass>() != nullptr, i % 3 == 0);
+    }
+
+    // rows of an archetype are packed
+    BOOST_CHECK(entities[3]->get_component<mass>() == entities[0]->get_component<mass>() + 1);
+
+    size_t len = 0;
+    em.for_entities_with<health, mass>([&](archetype_world_type::entity_type& e)
+    {
+      BOOST_CHECK_EQUAL(e.get_component<health>()->value % 3, 0u);
+      BOOST_CHECK_EQUAL(e.get_component<mass>()->value, e.get_component<health>()->value * 0.5);
+      ++len;
+    });
+    BOOST_CHECK_EQUAL(len, 1000u);
+
+    len = 0;
+    em.for_each_component<health>([&](archetype_world_type::entity_type& e, health& h)
+    {
+      BOOST_CHECK(e.get_component<health>() == &h);
+      BOOST_CHECK_EQUAL(e.get_component<position>()->x, h.value);
+      ++len;
+    });
+    BOOST_CHECK_EQUAL(len, 3000u);
+
+    // back to archetype {health}, the last row of {health, mass} fills the hole
+    entities[0]->delete_component<mass>();
+    BOOST_CHECK(entities[0]->get_component<mass>() == nullptr);
+    BOOST_CHECK_EQUAL(entities[0]->get_component<health>()->value, 0u);
+    BOOST_CHECK_EQUAL(entities[2997]->get_component<mass>()->value, 2997 * 0.5);
+
+    // remove the last archetype component
+    entities[1]->delete_component<health>();
+    BOOST_CHECK(entities[1]->get_component<health>() == nullptr);
+    BOOST_CHECK_EQUAL(entities[1]->get_component<position>()->x, 1);
+    BOOST_CHECK_EQUAL(counter_health, 2999);
+
+    for(uint16_t i = 0 ; i < 3000 ; i += 2)
+    {
+      em.delete_entity(*entities[i]);
+    }
+    BOOST_CHECK_EQUAL(counter_health, 1499);
+
+    len = 0;
+    em.for_entities_with<health>([&](archetype_world_type::entity_type& e)
+    {
+      BOOST_CHECK_EQUAL(e.get_component<health>()->value % 2, 1u);
+      ++len;
+    });
+    BOOST_CHECK_EQUAL(len, 1499u);
+
+    em.shrink_to_fit();
+    BOOST_CHECK_EQUAL(entities[2999]->get_component<health>()->value, 2999u);
+    BOOST_CHECK_EQUAL(entities[2997]->get_component<mass>()->value, 2997 * 0.5);
+  }
+  BOOST_CHECK_EQUAL(counter_health, 0);
+}
+
+BOOST_AUTO_TEST_CASE( entity_system_soa )
+{
+  soa_world_type world;
+
+  auto& em = world.get_entity_manager();
+  std::vector<soa_world_type::entity_type*> entities;
+  for(uint16_t i = 0 ; i < 100 ; ++i)
+  {
+    auto entity = em.new_entity();
+    entity->new_component<position>(i, i);
+    auto b = entity->new_component<body>(i, 2 * i, 1, -1);
+    BOOST_REQUIRE(b);
+    BOOST_CHECK(entity->new_component<body>() == nullptr);
+    entities.push_back(entity);
+  }
+
+  // one column per field
+  auto columns = em.get_columns<body>();
+  BOOST_REQUIRE_EQUAL(columns.size(), 100u);
+  float* x  = columns.column<0>();
+  float* vx = columns.column<2>();
+  for(size_t i = 0 ; i < columns.size() ; ++i)
+  {
+    x[i] += vx[i];
+  }
+  BOOST_CHECK(&entities[10]->get_component<body>()->get<0>() == x + 10);
+
+  for(uint16_t i = 0 ; i < 100 ; ++i)
+  {
+    auto b = entities[i]->get_component<body>();
+    BOOST_REQUIRE(b);
+    BOOST_CHECK_EQUAL(b->get<0>(), i + 1);
+    BOOST_CHECK_EQUAL(b->get<1>(), 2 * i);
+    BOOST_CHECK_EQUAL(columns.ids()[i], entities[i]->get_id());
+  }
+
+  // proxy load / store
+  auto b = entities[5]->get_component<body>();
+  body v = b->load();
+  BOOST_CHECK_EQUAL(v.x, 6);
+  BOOST_CHECK_EQUAL(v.vy, -1);
+  *b = body(1, 10, 3, 4);
+  BOOST_CHECK_EQUAL(columns[5].get<2>(), 3);
+
+  // swap and pop
+  entities[0]->delete_component<body>();
+  BOOST_CHECK(entities[0]->get_component<body>() == nullptr);
+  BOOST_CHECK(entities[99]->get_component<body>()->get<0>() == 100);
+  BOOST_CHECK(&entities[99]->get_component<body>()->get<0>() == x);
+
+  size_t len = 0;
+  em.for_each_component<body>([&](soa_world_type::entity_type& e, entity_system::soa_reference<body>& r)
+  {
+    BOOST_CHECK(e.get_component<body>() != nullptr);
+    BOOST_CHECK_EQUAL(r.get<1>(), 2 * e.get_component<position>()->x);
+    ++len;
+  });
+  BOOST_CHECK_EQUAL(len, 99u);
+
+  em.shrink_to_fit();
+  BOOST_CHECK_EQUAL(entities[50]->get_component<body>()->get<1>(), 100);
+  em.delete_entity(*entities[50]);
+  BOOST_CHECK_EQUAL(em.get_columns<body>().size(), 98u);
+}
+
+BOOST_AUTO_TEST_CASE( entity_system_view )
+{
+  world_type world;
+
+  auto& em = world.get_entity_manager();
+  std::vector<world_type::entity_type*> entities;
+  for(uint16_t i = 0 ; i < 1000 ; ++i)
+  {
+    auto entity = em.new_entity();
+    entity->new_component<position>(i, i);
+    if(i % 200 == 0)
+    {
+      entity->new_component<life>(i);
+    }
+    entities.push_back(entity);
+  }
+
+  // driven by the pool of life
+  auto view = em.get_view<position, life>();
+  BOOST_CHECK_EQUAL(view.size_hint(), 5u);
+
+  std::set<uint16_t> found;
+  view.for_each([&](world_type::entity_type& e)
+  {
+    found.insert(e.get_component<life>()->init);
+  });
+  BOOST_CHECK(found == std::set<uint16_t>({0, 200, 400, 600, 800}));
+
+  entities[200]->delete_component<position>();
+  entities[400]->new_component<life>(0);
+  size_t len = 0;
+  em.for_entities_with<position, life>([&](world_type::entity_type&)
+  {
+    ++len;
+  });
+  BOOST_CHECK_EQUAL(len, 4u);
+}
+
+BOOST_AUTO_TEST_CASE( entity_system_view_delete )
+{
+  // delete entities while iterating a packed pool (sparse set) or archetypes
+  {
+    sparse_world_type world;
+
+    auto& em = world.get_entity_manager();
+    for(int16_t i = 0 ; i < 100 ; ++i)
+    {
+      auto entity = em.new_entity();
+      entity->new_component<position>(i, i);
+      entity->new_component<velocity>(i, i);
+    }
+
+    size_t len = 0;
+    em.for_entities_with<position, velocity>([&](sparse_world_type::entity_type& e)
+    {
+      if(e.get_component<velocity>()->x % 2)
+      {
+        em.delete_entity(e);
+      }
+      ++len;
+    });
+    BOOST_CHECK_EQUAL(len, 100u);
+
+    len = 0;
+    em.get_view<velocity>().for_each([&](sparse_world_type::entity_type& e)
+    {
+      BOOST_CHECK_EQUAL(e.get_component<velocity>()->x % 2, 0);
+      ++len;
+    });
+    BOOST_CHECK_EQUAL(len, 50u);
+  }
+
+  {
+    archetype_world_type world;
+
+    auto& em = world.get_entity_manager();
+    for(uint16_t i = 0 ; i < 1000 ; ++i)
+    {
+      auto entity = em.new_entity();
+      entity->new_component<health>(i);
+      entity->new_component<mass>(i);
+    }
+
+    size_t len = 0;
+    em.for_entities_with<health, mass>([&](archetype_world_type::entity_type& e)
+    {
+      if(e.get_component<health>()->value % 2)
+      {
+        e.delete_component<mass>();
+      }
+      ++len;
+    });
+    BOOST_CHECK_EQUAL(len, 1000u);
+    BOOST_CHECK_EQUAL(em.get_view<mass>().size_hint(), 500u);
+    BOOST_CHECK_EQUAL(em.get_view<health>().size_hint(), 1000u);
+  }
+}
+
+BOOST_AUTO_TEST_CASE( entity_system_for_each )
+{
+  // segment and sparse set components
+  {
+    sparse_world_type world;
+
+    auto& em = world.get_entity_manager();
+    for(int16_t i = 0 ; i < 100 ; ++i)
+    {
+      auto entity = em.new_entity();
+      entity->new_component<position>(i, i);
+      if(i % 4 == 0)
+      {
+        entity->new_component<velocity>(1, -i);
+      }
+    }
+
+    size_t len = 0;
+    em.for_each<position, velocity>([&](sparse_world_type::entity_type& e, position& p, velocity& v)
+    {
+      BOOST_CHECK(e.get_component<position>() == &p);
+      BOOST_CHECK(e.get_component<velocity>() == &v);
+      p.x += v.x;
+      if(p.y % 8)
+      {
+        em.delete_entity(e);
+      }
+      ++len;
+    });
+    BOOST_CHECK_EQUAL(len, 25u);
+
+    len = 0;
+    em.for_each<position>([&](sparse_world_type::entity_type& e, position& p)
+    {
+      BOOST_CHECK_EQUAL(p.x, p.y + (e.get_component<velocity>() ? 1 : 0));
+      ++len;
+    });
+    BOOST_CHECK_EQUAL(len, 88u);
+  }
+
+  // archetype components
+  {
+    archetype_world_type world;
+
+    auto& em = world.get_entity_manager();
+    for(uint16_t i = 0 ; i < 1000 ; ++i)
+    {
+      auto entity = em.new_entity();
+      entity->new_component<health>(i);
+      if(i % 2)
+      {
+        entity->new_component<mass>(i);
+      }
+    }
+
+    size_t len = 0;
+    em.for_each<health, mass>([&](archetype_world_type::entity_type& e, health& h, mass& m)
+    {
+      BOOST_CHECK(e.get_component<health>() == &h);
+      BOOST_CHECK_EQUAL(m.value, h.value);
+      ++len;
+    });
+    BOOST_CHECK_EQUAL(len, 500u);
+  }
+
+  // struct of arrays components are given as references on their fields
+  {
+    soa_world_type world;
+
+    auto& em = world.get_entity_manager();
+    for(uint16_t i = 0 ; i < 100 ; ++i)
+    {
+      auto entity = em.new_entity();
+      entity->new_component<position>(i, i);
+      entity->new_component<body>(i, 2 * i, 1, -1);
+    }
+
+    size_t len = 0;
+    em.for_each<position, body>([&](soa_world_type::entity_type&, position& p, const entity_system::soa_reference<body>& b)
+    {
+      b.get<0>() += b.get<2>();
+      BOOST_CHECK_EQUAL(b.get<1>(), 2 * p.x);
+      ++len;
+    });
+    BOOST_CHECK_EQUAL(len, 100u);
+    BOOST_CHECK_EQUAL(em.get_columns<body>().column<0>()[10], 11);
+  }
+}
+
+BOOST_AUTO_TEST_CASE( entity_system_query_terms )
+{
+  using entity_system::without;
+  using entity_system::optional;
+
+  {
+    world_type world;
+
+    auto& em = world.get_entity_manager();
+    for(uint16_t i = 0 ; i < 1000 ; ++i)
+    {
+      auto entity = em.new_entity();
+      entity->new_component<position>(i, i);
+      if(i % 10 == 0)
+      {
+        entity->new_component<life>(i);
+      }
+    }
+    em.new_entity()->new_component<life>(0);
+
+    size_t len = 0;
+    em.for_entities_with<position, without<life>>([&](world_type::entity_type& e)
+    {
+      BOOST_CHECK(e.get_component<life>() == nullptr);
+      ++len;
+    });
+    BOOST_CHECK_EQUAL(len, 900u);
+
+    // only exclusions : all entities are scanned
+    len = 0;
+    em.for_entities_with<without<position>>([&](world_type::entity_type& e)
+    {
+      BOOST_CHECK(e.get_component<life>() != nullptr);
+      ++len;
+    });
+    BOOST_CHECK_EQUAL(len, 1u);
+
+    len = 0;
+    size_t with_life = 0;
+    em.for_each<optional<life>, position>([&](world_type::entity_type& e, position& p, life* l)
+    {
+      BOOST_CHECK(e.get_component<life>() == l);
+      BOOST_CHECK_EQUAL(l != nullptr, p.x % 10 == 0);
+      with_life += (l != nullptr);
+      ++len;
+    });
+    BOOST_CHECK_EQUAL(len, 1000u);
+    BOOST_CHECK_EQUAL(with_life, 100u);
+
+    // driven by the pool of life
+    len = 0;
+    em.for_each<life, without<position>>([&](world_type::entity_type&, life& l)
+    {
+      BOOST_CHECK_EQUAL(l.init, 0u);
+      ++len;
+    });
+    BOOST_CHECK_EQUAL(len, 1u);
+  }
+
+  // archetypes holding an excluded component are skipped
+  {
+    archetype_world_type world;
+
+    auto& em = world.get_entity_manager();
+    for(uint16_t i = 0 ; i < 100 ; ++i)
+    {
+      auto entity = em.new_entity();
+      entity->new_component<health>(i);
+      if(i % 4 == 0)
+      {
+        entity->new_component<mass>(i);
+      }
+    }
+
+    size_t len = 0;
+    em.for_each<health, without<mass>>([&](archetype_world_type::entity_type& e, health& h)
+    {
+      BOOST_CHECK(e.get_component<mass>() == nullptr);
+      BOOST_CHECK(h.value % 4 != 0);
+      ++len;
+    });
+    BOOST_CHECK_EQUAL(len, 75u);
+
+    len = 0;
+    em.for_each<health, optional<mass, position>>([&](archetype_world_type::entity_type&, health& h, mass* m, position* p)
+    {
+      BOOST_CHECK_EQUAL(m != nullptr, h.value % 4 == 0);
+      BOOST_CHECK(p == nullptr);
+      ++len;
+    });
+    BOOST_CHECK_EQUAL(len, 100u);
+  }
+}
+
+BOOST_AUTO_TEST_CASE( entity_system_for_each_chunk )
+{
+  {
+    sparse_world_type world;
+
+    auto& em = world.get_entity_manager();
+    std::vector<sparse_world_type::entity_type*> entities;
+    for(int16_t i = 0 ; i < 100 ; ++i)
+    {
+      entities.push_back(em.new_entity());
+      entities.back()->new_component<velocity>(i, 1);
+    }
+
+    size_t len = 0;
+    em.for_each_chunk<velocity>([&](size_t n, velocity* v, const entity_system::entity_id_type* ids)
+    {
+      for(size_t i = 0 ; i < n ; ++i)
+      {
+        v[i].y += v[i].x;
+        BOOST_CHECK_EQUAL(entities[v[i].x]->get_id(), ids[i]);
+        BOOST_CHECK(entities[v[i].x]->get_component<velocity>() == v + i);
+      }
+      len += n;
+    });
+    BOOST_CHECK_EQUAL(len, 100u);
+  }
+
+  {
+    archetype_world_type world;
+
+    auto& em = world.get_entity_manager();
+    for(uint16_t i = 0 ; i < 3000 ; ++i)
+    {
+      auto entity = em.new_entity();
+      entity->new_component<health>(i);
+      if(i % 3)
+      {
+        entity->new_component<mass>(2 * i);
+      }
+    }
+
+    size_t len = 0;
+    size_t nb_chunks = 0;
+    em.for_each_chunk<health, mass>([&](size_t n, health* h, mass* m, const entity_system::entity_id_type*)
+    {
+      for(size_t i = 0 ; i < n ; ++i)
+      {
+        BOOST_CHECK_EQUAL(m[i].value, 2 * h[i].value);
+      }
+      len += n;
+      ++nb_chunks;
+    });
+    BOOST_CHECK_EQUAL(len, 2000u);
+    BOOST_CHECK(nb_chunks > 1);
+  }
+}
+
+BOOST_AUTO_TEST_CASE( entity_system_cursor )
+{
+  world_type world;
+
+  auto& em = world.get_entity_manager();
+  std::vector<world_type::entity_type*> entities;
+  for(uint16_t i = 0 ; i < 100 ; ++i)
+  {
+    auto entity = em.new_entity();
+    entity->new_component<position>(i, i);
+    if(i % 2 == 0)
+    {
+      entity->new_component<life>(i);
+    }
+    entities.push_back(entity);
+  }
+
+  auto cursor = em.get_cursor<life>();
+  std::vector<uint16_t> seen;
+  auto visit = [&](world_type::entity_type& e)
+  {
+    seen.push_back(e.get_component<life>()->init);
+  };
+
+  // 50 entities with life : 5 slices of 10 then the end of the pass
+  for(size_t slice = 0 ; slice < 5 ; ++slice)
+  {
+    BOOST_CHECK(!cursor.for_each(10, visit));
+    BOOST_CHECK_EQUAL(seen.size(), (slice + 1) * 10);
+  }
+  BOOST_CHECK(cursor.for_each(10, visit));
+  BOOST_CHECK_EQUAL(seen.size(), 50u);
+  for(size_t i = 0 ; i < seen.size() ; ++i)
+  {
+    BOOST_CHECK_EQUAL(seen[i], 2 * i);
+  }
+
+  // changes between two slices
+  seen.clear();
+  BOOST_CHECK(!cursor.for_each(10, visit));
+  BOOST_CHECK_EQUAL(seen.back(), 18u);
+  em.delete_entity(*entities[18]);
+  em.delete_entity(*entities[20]);
+  entities[0]->delete_component<life>();
+  entities[21]->new_component<life>(21);
+  BOOST_CHECK(!cursor.for_each(2, visit));
+  BOOST_CHECK_EQUAL(seen[10], 21u);
+  BOOST_CHECK_EQUAL(seen[11], 22u);
+
+  // the rest of the pass within the time budget
+  BOOST_CHECK(cursor.for_each(std::chrono::seconds(10), visit));
+  BOOST_CHECK_EQUAL(seen.size(), 50u);
+
+  // a new entity is seen on the next pass
+  em.new_entity()->new_component<life>(1000);
+  seen.clear();
+  BOOST_CHECK(cursor.for_each(1000, visit));
+  BOOST_CHECK_EQUAL(seen.size(), 49u);
+  BOOST_CHECK(std::find(seen.begin(), seen.end(), 1000) != seen.end());
+
+  // entities without life count in the slice : a spent budget stops after one batch
+  for(uint16_t i = 0 ; i < 1000 ; ++i)
+  {
+    em.new_entity()->new_component<position>(i, i);
+  }
+  em.new_entity()->new_component<life>(2000);
+  seen.clear();
+  size_t slices = 1;
+  while(!cursor.for_each(std::chrono::nanoseconds(0), visit))
+  {
+    ++slices;
+  }
+  BOOST_CHECK_EQUAL(seen.size(), 50u);
+  BOOST_CHECK_GE(slices, em.size() / 64);
+}
+
+BOOST_AUTO_TEST_CASE( entity_system_sort )
+{
+  sparse_world_type world;
+
+  auto& em = world.get_entity_manager();
+  std::vector<sparse_world_type::entity_type*> entities;
+  for(int16_t i = 0 ; i < 100 ; ++i)
+  {
+    auto entity = em.new_entity();
+    entity->new_component<position>(i, i);
+    entity->new_component<velocity>((int16_t)((i * 37) % 100), i);
+    entities.push_back(entity);
+  }
+
+  // by key
+  BOOST_CHECK(em.sort<velocity>([](const velocity& a, const velocity& b) { return a.x < b.x; }));
+  std::vector<int16_t> keys;
+  em.for_each_component<velocity>([&](sparse_world_type::entity_type& e, velocity& v)
+  {
+    BOOST_CHECK_EQUAL(e.get_component<velocity>(), &v);
+    keys.push_back(v.x);
+  });
+  BOOST_CHECK_EQUAL(keys.size(), 100u);
+  BOOST_CHECK(std::is_sorted(keys.begin(), keys.end()));
+  for(int16_t i = 0 ; i < 100 ; ++i)
+  {
+    BOOST_CHECK_EQUAL(entities[i]->get_component<velocity>()->y, i);
+  }
+
+  // like the entities, a few moves per call
+  size_t calls = 1;
+  while(!em.sort_by_entity<velocity>(16))
+  {
+    ++calls;
+  }
+  BOOST_CHECK(calls > 1);
+  std::vector<int16_t> owners;
+  em.for_each_component<velocity>([&](sparse_world_type::entity_type&, velocity& v)
+  {
+    owners.push_back(v.y);
+  });
+  for(int16_t i = 0 ; i < 100 ; ++i)
+  {
+    BOOST_CHECK_EQUAL(owners[i], i);
+  }
+
+  // segment pool after churn, then velocity like position
+  for(int16_t i = 0 ; i < 100 ; i += 3)
+  {
+    entities[i]->delete_component<position>();
+    entities[i]->new_component<position>(i, i);
+  }
+  BOOST_CHECK(em.sort<position>([](const position& a, const position& b) { return a.x > b.x; }));
+  BOOST_CHECK((em.sort_like<velocity, position>()));
+  std::vector<uint16_t> xs;
+  std::vector<int16_t>  ys;
+  em.for_each_component<position>([&](sparse_world_type::entity_type&, position& p)
+  {
+    xs.push_back(p.x);
+  });
+  em.for_each_component<velocity>([&](sparse_world_type::entity_type&, velocity& v)
+  {
+    ys.push_back(v.y);
+  });
+  BOOST_REQUIRE_EQUAL(xs.size(), 100u);
+  for(size_t i = 0 ; i < xs.size() ; ++i)
+  {
+    BOOST_CHECK_EQUAL(xs[i], 99 - i);
+    BOOST_CHECK_EQUAL(ys[i], xs[i]);
+  }
+  for(int16_t i = 0 ; i < 100 ; ++i)
+  {
+    BOOST_CHECK_EQUAL(entities[i]->get_component<position>()->y, i);
+  }
+}
+
+BOOST_AUTO_TEST_CASE( entity_system_tag )
+{
+  static_assert(std::is_same<entity_system::component_storage<sleeping>::type, entity_system::tag_storage>::value, "tags are opted in");
+
+  entity_system::counting_resource resource;
+  tag_world_type world(&resource);
+
+  auto& em = world.get_entity_manager();
+  std::vector<tag_world_type::entity_type*> entities;
+  for(uint16_t i = 0 ; i < 100 ; ++i)
+  {
+    auto entity = em.new_entity();
+    entity->new_component<position>(i, i);
+    if(i < 10)
+    {
+      entity->new_component<velocity>((int16_t)i, (int16_t)i);
+    }
+    entities.push_back(entity);
+  }
+
+  // only the mask bits change
+  size_t bytes = resource.bytes_in_use();
+  size_t nb_allocations = resource.nb_allocations();
+  for(size_t i = 0 ; i < entities.size() ; i += 2)
+  {
+    BOOST_CHECK(entities[i]->new_component<sleeping>());
+    BOOST_CHECK(!entities[i]->new_component<sleeping>());
+  }
+  entities[3]->new_component<marked>();
+  entities[3]->delete_component<marked>();
+  BOOST_CHECK_EQUAL(resource.bytes_in_use(), bytes);
+  BOOST_CHECK_EQUAL(resource.nb_allocations(), nb_allocations);
+
+  BOOST_CHECK(entities[0]->get_component<sleeping>());
+  BOOST_CHECK(!entities[1]->get_component<sleeping>());
+  BOOST_CHECK(!entities[3]->get_component<marked>());
+
+  // queries : tag alone, with a small pool, excluded
+  size_t len = 0;
+  em.for_entities_with<sleeping>([&](tag_world_type::entity_type& e)
+  {
+    BOOST_CHECK(e.get_component<sleeping>());
+    ++len;
+  });
+  BOOST_CHECK_EQUAL(len, 50u);
+
+  len = 0;
+  em.for_each<velocity, sleeping>([&](tag_world_type::entity_type&, velocity& v, sleeping&)
+  {
+    BOOST_CHECK_EQUAL(v.x % 2, 0);
+    ++len;
+  });
+  BOOST_CHECK_EQUAL(len, 5u);
+
+  len = 0;
+  em.for_each<position, entity_system::without<sleeping>>([&](tag_world_type::entity_type&, position& p)
+  {
+    BOOST_CHECK_EQUAL(p.x % 2, 1);
+    ++len;
+  });
+  BOOST_CHECK_EQUAL(len, 50u);
+
+  // removed with the entity
+  em.delete_entity(*entities[0]);
+  entities[2]->delete_component<sleeping>();
+  len = 0;
+  em.get_view<sleeping, position>().for_each([&](tag_world_type::entity_type&)
+  {
+    ++len;
+  });
+  BOOST_CHECK_EQUAL(len, 48u);
+  BOOST_CHECK(!em.new_entity()->get_component<sleeping>());
+}
+
+BOOST_AUTO_TEST_CASE( entity_system_handle )
+{
+  world_type world;
+
+  auto& em = world.get_entity_manager();
+  BOOST_CHECK(!em.alive(entity_system::entity_handle()));
+  BOOST_CHECK(!em.get(entity_system::entity_handle()));
+
+  std::vector<entity_system::entity_handle> handles;
+  for(uint16_t i = 0 ; i < 100 ; ++i)
+  {
+    auto entity = em.new_entity();
+    entity->new_component<position>(i, i);
+    handles.push_back(entity->get_handle());
+  }
+  for(uint16_t i = 0 ; i < 100 ; ++i)
+  {
+    BOOST_CHECK(em.alive(handles[i]));
+    BOOST_CHECK(em.get(handles[i])->get_handle() == handles[i]);
+    BOOST_CHECK_EQUAL(em.get_component<position>(handles[i])->x, i);
+    BOOST_CHECK(!em.get_component<life>(handles[i]));
+  }
+
+  // malformed ids (position outside of the segment, unknown segment) never alias a live slot
+  const size_t   size = entity_system::segment_size<world_type::entity_type>::value;
+  const uint32_t bits = entity_system::detail::bits_for(size + 1);
+  entity_system::entity_handle forged[] = {
+    {(entity_system::entity_id_type)(1u << bits), handles[size - 1].generation},
+    {(entity_system::entity_id_type)(size + 1), handles[size].generation},
+    {(entity_system::entity_id_type)((1000u << bits) | 1), handles[0].generation},
+  };
+  for(const entity_system::entity_handle& handle : forged)
+  {
+    BOOST_CHECK(!em.alive(handle));
+    BOOST_CHECK(!em.get(handle));
+    BOOST_CHECK(!em.get_component<position>(handle));
+  }
+
+  // the slot of a deleted entity is reused : the old handle stays stale
+  entity_system::entity_handle old = handles[42];
+  em.delete_entity(*em.get(old));
+  BOOST_CHECK(!em.alive(old));
+  BOOST_CHECK(!em.get(old));
+  BOOST_CHECK(!em.get_component<position>(old));
+
+  auto entity = em.new_entity();
+  entity->new_component<position>(1000, 1000);
+  entity_system::entity_handle reused = entity->get_handle();
+  BOOST_CHECK_EQUAL(reused.id, old.id);
+  BOOST_CHECK(reused != old);
+  BOOST_CHECK(!em.alive(old));
+  BOOST_CHECK_EQUAL(em.get(reused), entity);
+  BOOST_CHECK_EQUAL(em.get_component<position>(reused)->x, 1000);
+
+  em.shrink_to_fit();
+  BOOST_CHECK(!em.alive(old));
+  BOOST_CHECK(em.alive(handles[99]));
+}
+
+BOOST_AUTO_TEST_CASE( entity_system_create_batch )
+{
+  archetype_world_type world;
+
+  auto& em = world.get_entity_manager();
+  auto& group = em.get_group<position, health>();
+  em.new_entity()->new_component<mass>(1.);
+
+  int32_t health_before = counter_health;
+  em.create_batch<position, health, mass>(1000, [](size_t i)
+  {
+    return position((uint16_t)i, 0);
+  }, [](size_t i)
+  {
+    return health((uint32_t)i * 2);
+  }, mass(0.5));
+  BOOST_CHECK_EQUAL(em.size(), 1001u);
+  BOOST_CHECK_EQUAL(counter_health - health_before, 1000);
+  BOOST_CHECK_EQUAL(group.size(), 1000u);
+
+  size_t len = 0;
+  em.for_each<position, health, mass>([&](archetype_world_type::entity_type& e, position& p, health& h, mass& m)
+  {
+    BOOST_CHECK_EQUAL(h.value, p.x * 2u);
+    BOOST_CHECK_EQUAL(m.value, 0.5);
+    BOOST_CHECK_EQUAL(e.get_component<health>(), &h);
+    ++len;
+  });
+  BOOST_CHECK_EQUAL(len, 1000u);
+
+  len = 0;
+  em.for_each<mass>([&](archetype_world_type::entity_type&, mass&)
+  {
+    ++len;
+  });
+  BOOST_CHECK_EQUAL(len, 1001u);
+
+  // entities of a batch are like the others
+  em.for_entities_with<health>([&](archetype_world_type::entity_type& e)
+  {
+    if(e.get_component<position>()->x % 2)
+    {
+      e.delete_component<mass>();
+    }
+    else
+    {
+      em.delete_entity(e);
+    }
+  });
+  BOOST_CHECK_EQUAL(em.size(), 501u);
+  BOOST_CHECK_EQUAL(group.size(), 500u);
+  BOOST_CHECK_EQUAL(counter_health - health_before, 500);
+
+  sparse_world_type sparse_world;
+  auto& sparse_em = sparse_world.get_entity_manager();
+  sparse_em.create_batch<velocity>(100, velocity(1, 2));
+  sparse_em.create_batch<position, velocity>(0, position(0, 0), velocity(0, 0));
+  len = 0;
+  sparse_em.for_each<velocity>([&](sparse_world_type::entity_type& e, velocity& v)
+  {
+    BOOST_CHECK(!e.get_component<position>());
+    BOOST_CHECK_EQUAL(v.y, 2);
+    ++len;
+  });
+  BOOST_CHECK_EQUAL(len, 100u);
+}
+
+BOOST_AUTO_TEST_CASE( entity_system_command_buffer )
+{
+  typedef world_type::entity_manager_type::command_buffer command_buffer;
+
+  world_type world;
+
+  auto& em = world.get_entity_manager();
+  std::vector<entity_system::entity_handle> handles;
+  for(uint16_t i = 0 ; i < 10 ; ++i)
+  {
+    auto entity = em.new_entity();
+    entity->new_component<position>(i, i);
+    handles.push_back(entity->get_handle());
+  }
+
+  // one buffer per thread, recorded while the world is iterated
+  std::vector<command_buffer> buffers;
+  for(size_t t = 0 ; t < 4 ; ++t)
+  {
+    buffers.emplace_back();
+  }
+  std::vector<std::thread> threads;
+  for(size_t t = 0 ; t < buffers.size() ; ++t)
+  {
+    threads.emplace_back([&, t]()
+    {
+      command_buffer& buffer = buffers[t];
+      for(uint16_t i = 0 ; i < 100 ; ++i)
+      {
+        entity_system::entity_handle h = buffer.new_entity();
+        buffer.new_component<position>(h, (uint16_t)(1000 * (t + 1) + i), i);
+        if(i % 10 == 0)
+        {
+          buffer.new_component<life>(h, i);
+        }
+        if(i % 50 == 0)
+        {
+          buffer.delete_entity(h);
+          buffer.new_component<life>(h, 1);
+        }
+      }
+      buffer.delete_component<position>(handles[t]);
+    });
+  }
+  for(std::thread& thread : threads)
+  {
+    thread.join();
+  }
+  BOOST_CHECK_EQUAL(em.size(), 10u);
+  BOOST_CHECK(!buffers[0].empty());
+
+  em.apply(buffers.begin(), buffers.end());
+  for(command_buffer& buffer : buffers)
+  {
+    BOOST_CHECK(buffer.empty());
+  }
+  BOOST_CHECK_EQUAL(em.size(), 10u + 4 * 98);
+
+  // buffers are applied in order, each in the order of its commands
+  std::vector<uint16_t> xs;
+  em.for_entities_with<position>([&](world_type::entity_type& e)
+  {
+    xs.push_back(e.get_component<position>()->x);
+  });
+  BOOST_REQUIRE_EQUAL(xs.size(), 6u + 4 * 98);
+  BOOST_CHECK(std::is_sorted(xs.begin(), xs.end()));
+  size_t len = 0;
+  em.for_entities_with<life>([&](world_type::entity_type& e)
+  {
+    BOOST_CHECK_EQUAL(e.get_component<life>()->init, e.get_component<position>()->y);
+    ++len;
+  });
+  BOOST_CHECK_EQUAL(len, 4u * 8);
+  for(size_t t = 0 ; t < 4 ; ++t)
+  {
+    BOOST_CHECK(!em.get_component<position>(handles[t]));
+  }
+
+  // commands on a deleted entity are skipped, buffers are reused
+  command_buffer buffer;
+  buffer.new_component<life>(handles[5], 5);
+  buffer.delete_entity(handles[6]);
+  em.delete_entity(*em.get(handles[5]));
+  em.apply(buffer);
+  BOOST_CHECK(!em.alive(handles[6]));
+  BOOST_CHECK_EQUAL(em.size(), 10u + 4 * 98 - 2);
+
+  buffer.new_component<life>(handles[7], 7);
+  em.apply(buffer);
+  BOOST_CHECK_EQUAL(em.get_component<life>(handles[7])->init, 7);
+
+  // default handles, and handles of another buffer, are never alive
+  command_buffer other;
+  other.new_entity();
+  entity_system::entity_handle foreign = other.new_entity();
+  buffer.new_component<life>(entity_system::entity_handle{}, 1);
+  buffer.delete_component<position>(entity_system::entity_handle{});
+  buffer.delete_entity(entity_system::entity_handle{});
+  buffer.new_component<life>(foreign, 1);
+  buffer.delete_entity(foreign);
+  em.apply(buffer);
+  BOOST_CHECK_EQUAL(em.size(), 10u + 4 * 98 - 2);
+}
+
+BOOST_AUTO_TEST_CASE( entity_system_archetype_scan_remove )
+{
+  charge_world_type world;
+
+  auto& em = world.get_entity_manager();
+  em.new_entity()->new_component<charge>(0);
+  std::vector<charge_world_type::entity_type*> entities;
+  for(uint32_t i = 0 ; i < 3 ; ++i)
+  {
+    auto entity = em.new_entity();
+    entity->new_component<health>(i);
+    entity->new_component<mass>(i);
+    entities.push_back(entity);
+  }
+
+  // the archetype {mass} is created during the scan
+  size_t len = 0;
+  em.for_entities_with<health, mass>([&](charge_world_type::entity_type& e)
+  {
+    e.delete_component<health>();
+    ++len;
+  });
+  BOOST_CHECK_EQUAL(len, 3u);
+  for(charge_world_type::entity_type* e : entities)
+  {
+    BOOST_CHECK(!e->get_component<health>());
+    BOOST_REQUIRE(e->get_component<mass>());
+    BOOST_CHECK_EQUAL(e->get_component<mass>()->value, e == entities[0] ? 0 : e == entities[1] ? 1 : 2);
+  }
+
+  // same with for_each, in a new world
+  charge_world_type other;
+  auto& other_em = other.get_entity_manager();
+  other_em.new_entity()->new_component<charge>(0);
+  for(uint32_t i = 0 ; i < 3 ; ++i)
+  {
+    auto entity = other_em.new_entity();
+    entity->new_component<health>(i);
+    entity->new_component<mass>(i);
+  }
+  len = 0;
+  other_em.for_each<health, mass>([&](charge_world_type::entity_type& e, health& h, mass& m)
+  {
+    BOOST_CHECK_EQUAL(h.value, m.value);
+    e.delete_component<health>();
+    ++len;
+  });
+  BOOST_CHECK_EQUAL(len, 3u);
+  len = 0;
+  other_em.for_entities_with<mass>([&](charge_world_type::entity_type& e)
+  {
+    BOOST_CHECK(!e.get_component<health>());
+    ++len;
+  });
+  BOOST_CHECK_EQUAL(len, 3u);
+}
+
+BOOST_AUTO_TEST_CASE( entity_system_clone )
+{
+  archetype_world_type world;
+
+  auto& em = world.get_entity_manager();
+  auto& group = em.get_group<health, mass>();
+  auto source = em.new_entity();
+  source->new_component<position>(1, 2);
+  source->new_component<health>(10);
+  source->new_component<mass>(2.5);
+
+  auto copy = em.clone(*source);
+  BOOST_CHECK(copy->get_component_mask() == source->get_component_mask());
+  BOOST_CHECK(copy->get_component<position>() != source->get_component<position>());
+  BOOST_CHECK_EQUAL(copy->get_component<position>()->y, 2);
+  BOOST_CHECK_EQUAL(copy->get_component<health>()->value, 10u);
+  BOOST_CHECK_EQUAL(copy->get_component<mass>()->value, 2.5);
+  BOOST_CHECK_EQUAL(group.size(), 2u);
+
+  // prefab from an entity, changed then instantiated
+  archetype_world_type::entity_manager_type::prefab unit(*source);
+  source->delete_component<position>();
+  copy->delete_component<position>();
+  BOOST_CHECK_EQUAL(unit.get<health>()->value, 10u);
+  unit.set<health>(20);
+  unit.reset<mass>();
+  BOOST_CHECK(!unit.get<mass>());
+
+  int32_t health_before = counter_health;
+  em.instantiate(unit, 100);
+  BOOST_CHECK_EQUAL(em.size(), 102u);
+  BOOST_CHECK_EQUAL(counter_health - health_before, 100);
+  BOOST_CHECK_EQUAL(group.size(), 2u);
+  size_t len = 0;
+  em.for_each<position, health>([&](archetype_world_type::entity_type& e, position& p, health& h)
+  {
+    BOOST_CHECK(!e.get_component<mass>());
+    BOOST_CHECK_EQUAL(p.x, 1);
+    BOOST_CHECK_EQUAL(h.value, 20u);
+    ++len;
+  });
+  BOOST_CHECK_EQUAL(len, 100u);
+
+  // other storages : sparse set (may grow while copied), struct of arrays, tag
+  tag_world_type tag_world;
+  auto& tag_em = tag_world.get_entity_manager();
+  auto tagged = tag_em.new_entity();
+  tagged->new_component<velocity>(3, 4);
+  tagged->new_component<sleeping>();
+  for(size_t i = 0 ; i < 100 ; ++i)
+  {
+    auto c = tag_em.clone(*tagged);
+    BOOST_CHECK_EQUAL(c->get_component<velocity>()->y, 4);
+    BOOST_CHECK(c->get_component<sleeping>());
+    BOOST_CHECK(!c->get_component<position>());
+  }
+
+  soa_world_type soa_world;
+  auto& soa_em = soa_world.get_entity_manager();
+  auto b = soa_em.new_entity();
+  b->new_component<body>(1.f, 2.f, 3.f, 4.f);
+  auto b2 = soa_em.clone(*b);
+  BOOST_CHECK_EQUAL(b2->get_component<body>()->get<3>(), 4.f);
+  soa_world_type::entity_manager_type::prefab bodies(*b2);
+  soa_em.instantiate(bodies, 10);
+  BOOST_CHECK_EQUAL(soa_em.get_columns<body>().size(), 12u);
+}
+
+BOOST_AUTO_TEST_CASE( entity_system_group )
+{
+  world_type world;
+
+  auto& em = world.get_entity_manager();
+  std::vector<world_type::entity_type*> entities;
+  for(uint16_t i = 0 ; i < 100 ; ++i)
+  {
+    auto entity = em.new_entity();
+    entity->new_component<position>(i, i);
+    if(i % 2 == 0)
+    {
+      entity->new_component<life>(i);
+    }
+    entities.push_back(entity);
+  }
+
+  auto& group = em.get_group<position, life>();
+  BOOST_CHECK((&group == &em.get_group<life, position>()));
+  BOOST_CHECK_EQUAL(group.size(), 50u);
+  BOOST_CHECK(group.contains(*entities[0]));
+  BOOST_CHECK(!group.contains(*entities[1]));
+
+  // incremental update
+  entities[1]->new_component<life>(1);
+  BOOST_CHECK_EQUAL(group.size(), 51u);
+  BOOST_CHECK(group.contains(*entities[1]));
+
+  entities[0]->delete_component<position>();
+  BOOST_CHECK_EQUAL(group.size(), 50u);
+  BOOST_CHECK(!group.contains(*entities[0]));
+
+  em.delete_entity(*entities[2]);
+  BOOST_CHECK_EQUAL(group.size(), 49u);
+
+  auto new_entity = em.new_entity();
+  new_entity->new_component<life>(1000);
+  BOOST_CHECK_EQUAL(group.size(), 49u);
+  new_entity->new_component<position>(0, 0);
+  BOOST_CHECK_EQUAL(group.size(), 50u);
+
+  std::set<world_type::entity_type*> expected;
+  em.for_entities_with<position, life>([&](world_type::entity_type& e)
+  {
+    expected.insert(&e);
+  });
+  BOOST_CHECK(std::set<world_type::entity_type*>(group.begin(), group.end()) == expected);
+
+  // delete members while iterating
+  size_t len = 0;
+  group.for_each([&](world_type::entity_type& e)
+  {
+    e.delete_component<life>();
+    ++len;
+  });
+  BOOST_CHECK_EQUAL(len, 50u);
+  BOOST_CHECK(group.empty());
+
+  em.delete_group<position, life>();
+  entities[5]->new_component<life>(5);
+}
+
+BOOST_AUTO_TEST_CASE( entity_system_group_archetype )
+{
+  archetype_world_type world;
+
+  auto& em    = world.get_entity_manager();
+  auto& group = em.get_group<health, mass>();
+  for(uint16_t i = 0 ; i < 10 ; ++i)
+  {
+    auto entity = em.new_entity();
+    entity->new_component<health>(i);
+    entity->new_component<mass>(i);
+    entity->new_component<position>(i, i);
+  }
+  BOOST_CHECK_EQUAL(group.size(), 10u);
+
+  // archetype components dropped in one step
+  group.for_each([&](archetype_world_type::entity_type& e)
+  {
+    em.delete_entity(e);
+  });
+  BOOST_CHECK(group.empty());
+}
+
+BOOST_AUTO_TEST_CASE( entity_system_wide_mask )
+{
+  wide_world_type world;
+
+  auto& em = world.get_entity_manager();
+  std::vector<wide_world_type::entity_type*> entities;
+  for(size_t i = 0 ; i < 1000 ; ++i)
+  {
+    auto entity = em.new_entity();
+    entity->new_component<flag<1>>();
+    if(i % 2 == 0)
+    {
+      entity->new_component<flag<66>>();
+    }
+    if(i % 5 == 0)
+    {
+      entity->new_component<flag<69>>();
+    }
+    entities.push_back(entity);
+  }
+
+  // empty components without a storage specialization keep one instance per entity
+  static_assert(std::is_same<entity_system::component_storage<flag<1>>::type, entity_system::segment_storage>::value, "tags are opt-in");
+  BOOST_CHECK(entities[0]->get_component<flag<1>>() != entities[1]->get_component<flag<1>>());
+  entities[1]->delete_component<flag<1>>();
+  BOOST_CHECK(!entities[1]->get_component<flag<1>>());
+  entities[1]->new_component<flag<1>>();
+
+  // dense scan of the masks (pools are large)
+  std::set<wide_world_type::entity_type*> found;
+  em.for_entities_with<flag<1>, flag<66>, flag<69>>([&](wide_world_type::entity_type& e)
+  {
+    found.insert(&e);
+  });
+  BOOST_CHECK_EQUAL(found.size(), 100u);
+  for(size_t i = 0 ; i < 1000 ; i += 10)
+  {
+    BOOST_CHECK(found.count(entities[i]));
+  }
+
+  // delete during the scan
+  size_t len = 0;
+  em.for_entities_with<flag<1>, flag<69>>([&](wide_world_type::entity_type& e)
+  {
+    em.delete_entity(e);
+    ++len;
+  });
+  BOOST_CHECK_EQUAL(len, 200u);
+
+  len = 0;
+  em.for_entities_with<flag<1>>([&](wide_world_type::entity_type&)
+  {
+    ++len;
+  });
+  BOOST_CHECK_EQUAL(len, 800u);
+
+  // entity slots are reused with a clear mask
+  auto entity = em.new_entity();
+  len = 0;
+  em.for_entities_with<flag<66>>([&](wide_world_type::entity_type& e)
+  {
+    BOOST_CHECK(&e != entity);
+    ++len;
+  });
+  BOOST_CHECK_EQUAL(len, 400u);
+}
+
+BOOST_AUTO_TEST_CASE( entity_system_paged_mapping )
+{
+  entity_system::counting_resource resource;
+  sparse_world_type world(&resource);
+
+  auto& em = world.get_entity_manager();
+  std::vector<sparse_world_type::entity_type*> entities;
+  for(size_t i = 0 ; i < 20000 ; ++i)
+  {
+    entities.push_back(em.new_entity());
+  }
+
+  // a few far apart ids only map their own pages
+  size_t bytes = resource.bytes_in_use();
+  entities[5]->new_component<velocity>((int16_t)5, (int16_t)5);
+  entities[19999]->new_component<velocity>((int16_t)1, (int16_t)2);
+  BOOST_CHECK_LT(resource.bytes_in_use() - bytes, 20000 * sizeof(uint32_t));
+
+  BOOST_CHECK_EQUAL(entities[19999]->get_component<velocity>()->y, 2);
+  BOOST_CHECK(!entities[10000]->get_component<velocity>());
+  BOOST_CHECK(!entities[19998]->get_component<velocity>());
+
+  // empty pages are released
+  size_t mapped = resource.bytes_in_use();
+  entities[19999]->delete_component<velocity>();
+  BOOST_CHECK_LT(resource.bytes_in_use(), mapped);
+  BOOST_CHECK_EQUAL(entities[5]->get_component<velocity>()->x, 5);
+
+  entity_system::detail::paged_map<uint32_t, 0xffffffff, 16> map;
+  BOOST_CHECK_EQUAL(map.get(100), 0xffffffffu);
+  map.set(100, 1);
+  map.set(101, 2);
+  BOOST_CHECK_EQUAL(map.nb_pages(), 1u);
+  BOOST_CHECK_EQUAL(map.get(101), 2u);
+  BOOST_CHECK(!map.find(3));
+  map.set(100, 0xffffffff);
+  map.set(101, 0xffffffff);
+  BOOST_CHECK_EQUAL(map.nb_pages(), 0u);
+
+  // reserve only sizes the page table, reserve_pages keeps pages until shrink_to_fit
+  map.reserve(1000);
+  BOOST_CHECK_EQUAL(map.nb_pages(), 0u);
+  map.reserve_pages(32);
+  BOOST_CHECK_EQUAL(map.nb_pages(), 2u);
+  map.set(3, 1);
+  map.set(3, 0xffffffff);
+  BOOST_CHECK_EQUAL(map.nb_pages(), 2u);
+  map.set(20, 1);
+  map.shrink_to_fit();
+  BOOST_CHECK_EQUAL(map.nb_pages(), 1u);
+  BOOST_CHECK_EQUAL(map.get(20), 1u);
+}
@@ -0,0 +1,222 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_AUTO_TEST_MAIN
+#include <boost/test/auto_unit_test.hpp>
+#include <boost/test/unit_test_suite.hpp>
+#include <boost/test/unit_test.hpp>
+
+#include <entity_system/memory_resource.hpp>
+#include <entity_system/entity_system.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+  class position
+  {
+    public:
+      position(uint16_t x, uint16_t y)
+        : x(x)
+        , y(y)
+      {
+      }
+
+      uint16_t x;
+      uint16_t y;
+  };
+
+  class e1 {};
+
+  typedef entity_system::world<std::tuple<e1>, std::tuple<position>> world_type;
+
+  class handler_e1 : public entity_system::listener<e1>
+  {
+    public:
+      handler_e1() : count_(0) {}
+
+      virtual void handle(e1&) override
+      {
+        ++count_;
+      }
+
+      uint32_t count_;
+  };
+
+  struct alignas(64) over_aligned
+  {
+    uint8_t data[64];
+  };
+}
+
+BOOST_AUTO_TEST_CASE( new_delete_resource_align )
+{
+  entity_system::memory_resource* resource = entity_system::default_resource();
+  void* p = resource->allocate(sizeof(over_aligned), alignof(over_aligned));
+  BOOST_CHECK_EQUAL((size_t)p % alignof(over_aligned), 0u);
+  resource->deallocate(p, sizeof(over_aligned), alignof(over_aligned));
+}
+
+BOOST_AUTO_TEST_CASE( counting_resource_shrink )
+{
+  entity_system::counting_resource counter;
+
+  world_type world(&counter);
+  auto& em = world.get_entity_manager();
+  size_t used = counter.bytes_in_use();
+
+  std::vector<world_type::entity_type*> entities;
+  for(uint16_t i = 0 ; i < 10000 ; ++i)
+  {
+    entities.push_back(em.new_entity());
+    entities.back()->new_component<position>(i, i);
+  }
+  size_t peak = counter.bytes_in_use();
+
+  for(world_type::entity_type* e : entities)
+  {
+    em.delete_entity(*e);
+  }
+  em.shrink_to_fit();
+  BOOST_CHECK(counter.bytes_in_use() < peak / 10);
+  BOOST_CHECK(counter.bytes_in_use() <= used + 1024);
+}
+
+BOOST_AUTO_TEST_CASE( counting_resource )
+{
+  entity_system::counting_resource counter;
+
+  {
+    world_type world(&counter);
+    BOOST_CHECK(world.get_memory_resource() == &counter);
+
+    auto& em = world.get_entity_manager();
+    for(uint16_t i = 0 ; i < 100 ; ++i)
+    {
+      em.new_entity()->new_component<position>(i, i);
+    }
+    BOOST_CHECK(counter.bytes_in_use() > 100 * sizeof(position));
+    size_t used = counter.bytes_in_use();
+
+    // groups
+    em.get_group<position>();
+    BOOST_CHECK(counter.bytes_in_use() > used);
+    em.delete_group<position>();
+    BOOST_CHECK(counter.bytes_in_use() <= used + 64);
+    used = counter.bytes_in_use();
+
+    // listeners, then handler pool
+    handler_e1 handler;
+    auto& dispatcher = world.get_system_manager().get_dispatcher();
+    dispatcher.connect(handler);
+    BOOST_CHECK(counter.bytes_in_use() > used);
+    used = counter.bytes_in_use();
+    dispatcher.push_emplace<e1>();
+    BOOST_CHECK(counter.bytes_in_use() > used);
+    dispatcher.dispatch();
+    BOOST_CHECK_EQUAL(handler.count_, 1u);
+    dispatcher.disconnect(handler);
+  }
+
+  BOOST_CHECK_EQUAL(counter.bytes_in_use(), 0u);
+  BOOST_CHECK(counter.peak_bytes() > 0);
+  BOOST_CHECK(counter.nb_allocations() > 0);
+}
+
+#ifdef ENTITY_SYSTEM_HAS_MMAP
+BOOST_AUTO_TEST_CASE( mmap_resource )
+{
+  entity_system::mmap_resource    mmap;
+  entity_system::counting_resource counter(&mmap);
+
+  // small go upstream
+  void* small = counter.allocate(128, 8);
+  BOOST_REQUIRE(small != nullptr);
+  counter.deallocate(small, 128, 8);
+
+  // mapped
+  void* large = counter.allocate(1024 * 1024, 8);
+  BOOST_REQUIRE(large != nullptr);
+  std::memset(large, 1, 1024 * 1024);
+  counter.deallocate(large, 1024 * 1024, 8);
+
+  // huge page aligned
+  size_t size = 3 * entity_system::mmap_resource::huge_page_size;
+  void* huge = counter.allocate(size, 8);
+  BOOST_REQUIRE(huge != nullptr);
+  BOOST_CHECK_EQUAL((size_t)huge % entity_system::mmap_resource::huge_page_size, 0u);
+  std::memset(huge, 1, size);
+  counter.deallocate(huge, size, 8);
+
+  // refused mapping
+  BOOST_CHECK_THROW(counter.allocate((size_t)1 << 62, 8), std::bad_alloc);
+
+  BOOST_CHECK_EQUAL(counter.bytes_in_use(), 0u);
+
+  // a whole world
+  {
+    world_type world(&counter);
+    auto& em = world.get_entity_manager();
+    em.reserve(100000);
+    em.reserve<position>(100000);
+    for(uint32_t i = 0 ; i < 100000 ; ++i)
+    {
+      em.new_entity()->new_component<position>(i, i);
+    }
+    size_t count = 0;
+    em.for_entities_with<position>([&](auto&) { ++count; });
+    BOOST_CHECK_EQUAL(count, 100000u);
+  }
+  BOOST_CHECK_EQUAL(counter.bytes_in_use(), 0u);
+}
+
+BOOST_AUTO_TEST_CASE( mmap_resource_discard )
+{
+  entity_system::mmap_resource mmap(false);
+  typedef entity_system::dynamic_segment<uint64_t, 4096> segment_type;
+
+  segment_type segment(&mmap);
+  segment.reserve(4096 * 64);
+
+  std::vector<segment_type::id_type> ids;
+  for(uint64_t i = 0 ; i < 4096 * 64 ; ++i)
+  {
+    ids.push_back(segment.acquire(i).second);
+  }
+
+  // pages strictly inside the released segments
+  size_t page_size = (size_t)::sysconf(_SC_PAGESIZE);
+  size_t begin = ((size_t)segment.get(ids[4096]) + page_size - 1) & ~(page_size - 1);
+  size_t end   = (size_t)segment.get(ids[4096 * 63 - 1]) & ~(page_size - 1);
+
+  // keep first and last segment
+  for(size_t i = 4096 ; i < 4096 * 63 ; ++i)
+  {
+    segment.release(ids[i]);
+  }
+  segment.shrink_to_fit();
+
+  // they are given back to the system
+  std::vector<unsigned char> resident((end - begin) / page_size);
+  BOOST_CHECK_EQUAL(::mincore((void*)begin, end - begin, resident.data()), 0);
+  BOOST_CHECK_EQUAL(std::count_if(resident.begin(), resident.end(), [](unsigned char page)
+  {
+    return page & 1;
+  }), 0);
+
+  uint64_t count = 0;
+  for(uint64_t* v : segment)
+  {
+    BOOST_CHECK(*v < 4096 || *v >= 4096 * 63);
+    ++count;
+  }
+  BOOST_CHECK_EQUAL(count, 4096u * 2);
+
+  // discarded segments are usable
+  for(size_t i = 4096 ; i < 4096 * 63 ; ++i)
+  {
+    BOOST_CHECK_EQUAL(segment.acquire(i).second, ids[i]);
+  }
+  BOOST_CHECK_EQUAL(*segment.get(ids[4096 * 2]), 4096u * 2);
+}
+#endif
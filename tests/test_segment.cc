@@ -7,6 +7,7 @@
 #include <entity_system/segment.hpp>
 
 #include <set>
+#include <map>
 #include <boost/mpl/list.hpp>
 
 namespace
@@ -20,6 +21,12 @@ namespace
       ++counter_data;
     }
 
+    data(const data& other)
+      : value(other.value)
+    {
+      ++counter_data;
+    }
+
     ~data()
     {
       --counter_data;
@@ -30,10 +37,12 @@ namespace
 }
 
 BOOST_TEST_DONT_PRINT_LOG_VALUE(data*);
+#if BOOST_VERSION < 106400
 BOOST_TEST_DONT_PRINT_LOG_VALUE(nullptr_t);
+#endif
 
-typedef boost::mpl::list<entity_system::segment<data, 8>, entity_system::segment<data, 16>, entity_system::segment<data, 32>, entity_system::segment<data, 64>> list_segment_type;
-typedef boost::mpl::list<entity_system::dynamic_segment<data, 8>, entity_system::dynamic_segment<data, 16>, entity_system::dynamic_segment<data, 32>, entity_system::dynamic_segment<data, 64>> list_dynamic_segment_type;
+typedef boost::mpl::list<entity_system::segment<data, 8>, entity_system::segment<data, 16>, entity_system::segment<data, 32>, entity_system::segment<data, 64>, entity_system::segment<data, 256>, entity_system::segment<data, 4096>> list_segment_type;
+typedef boost::mpl::list<entity_system::dynamic_segment<data, 8>, entity_system::dynamic_segment<data, 16>, entity_system::dynamic_segment<data, 32>, entity_system::dynamic_segment<data, 64>, entity_system::dynamic_segment<data, 256>, entity_system::dynamic_segment<data, 4096>> list_dynamic_segment_type;
 
 BOOST_AUTO_TEST_CASE_TEMPLATE(segment, segment_type, list_segment_type)
 {
@@ -186,3 +195,353 @@ BOOST_AUTO_TEST_CASE_TEMPLATE(dynamic_segment, segment_type, list_dynamic_segmen
   segment.clear();
   BOOST_CHECK_EQUAL(counter_data, 0u);
 }
+
+BOOST_AUTO_TEST_CASE_TEMPLATE(dynamic_segment_sparse, segment_type, list_dynamic_segment_type)
+{
+  counter_data = 0;
+  segment_type segment;
+
+  // alloc 5 segments
+  std::vector<typename segment_type::id_type> ids;
+  for(uint32_t i = 0 ; i < segment_type::size * 5; ++i)
+  {
+    ids.push_back(segment.acquire(i).second);
+  }
+
+  // keep first of segment 1 and last of segment 3
+  for(uint32_t i = 0 ; i < ids.size() ; ++i)
+  {
+    if(i != segment_type::size && i != segment_type::size * 4 - 1)
+    {
+      segment.release(ids[i]);
+    }
+  }
+  BOOST_CHECK_EQUAL(counter_data, 2u);
+
+  // iterate
+  std::vector<uint32_t> values;
+  for(data*d : segment)
+  {
+    values.push_back(d->value);
+  }
+  BOOST_REQUIRE_EQUAL(values.size(), 2u);
+  BOOST_CHECK_EQUAL(values[0], segment_type::size);
+  BOOST_CHECK_EQUAL(values[1], segment_type::size * 4 - 1);
+
+  // full desalloc
+  segment.clear();
+  BOOST_CHECK_EQUAL(counter_data, 0u);
+}
+
+BOOST_AUTO_TEST_CASE(hierarchical_bitmap)
+{
+  entity_system::detail::hierarchical_bitmap bitmap;
+  BOOST_CHECK_EQUAL(bitmap.find_first(), entity_system::detail::hierarchical_bitmap::npos());
+
+  // 3 levels
+  bitmap.resize(300000);
+  BOOST_CHECK_EQUAL(bitmap.find_first(), entity_system::detail::hierarchical_bitmap::npos());
+
+  std::set<size_t> ref {299999, 70000, 4096, 4095, 65};
+  for(size_t i : ref)
+  {
+    bitmap.set(i);
+    BOOST_CHECK(bitmap.test(i));
+  }
+
+  while(!ref.empty())
+  {
+    BOOST_CHECK_EQUAL(bitmap.find_first(), *ref.begin());
+    bitmap.reset(*ref.begin());
+    ref.erase(ref.begin());
+  }
+  BOOST_CHECK_EQUAL(bitmap.find_first(), entity_system::detail::hierarchical_bitmap::npos());
+
+  // grow keeps bits
+  bitmap.resize(10);
+  bitmap.set(3);
+  bitmap.resize(500000);
+  BOOST_CHECK_EQUAL(bitmap.find_first(), 3u);
+  bitmap.set(400000);
+  bitmap.reset(3);
+  BOOST_CHECK_EQUAL(bitmap.find_first(), 400000u);
+
+  // shrink drops bits
+  bitmap.resize(100);
+  BOOST_CHECK_EQUAL(bitmap.find_first(), entity_system::detail::hierarchical_bitmap::npos());
+}
+
+BOOST_AUTO_TEST_CASE(match_64)
+{
+  std::vector<uint64_t> words(64);
+  uint64_t query = 0x8000000000000005ull;
+  uint64_t ref   = 0;
+  for(size_t i = 0 ; i < 64 ; ++i)
+  {
+    words[i] = (i * 0x9E3779B97F4A7C15ull) | (i % 3 ? query : 0);
+    if((words[i] & query) == query)
+    {
+      ref |= (uint64_t)1 << i;
+    }
+  }
+  BOOST_CHECK_EQUAL(entity_system::detail::match_64(words.data(), query), ref);
+
+  // none of the high bit
+  uint64_t none = 0;
+  for(size_t i = 0 ; i < 64 ; ++i)
+  {
+    if(!(words[i] >> 63))
+    {
+      none |= (uint64_t)1 << i;
+    }
+  }
+  BOOST_CHECK_EQUAL(entity_system::detail::match_64(words.data(), 0x8000000000000000ull, 0), none);
+
+  // only the high half of a word differs (checks the 64 bits compare)
+  words.assign(64, 5);
+  BOOST_CHECK_EQUAL(entity_system::detail::match_64(words.data(), query), 0u);
+}
+
+BOOST_AUTO_TEST_CASE(mask_columns)
+{
+  typedef entity_system::detail::mask_columns<2> masks_type;
+  masks_type masks;
+  masks.resize(1000);
+
+  for(size_t i = 0 ; i < 1000 ; ++i)
+  {
+    masks.set(i, 3, i % 2 == 0);
+    masks.set(i, 70, i % 3 == 0);
+  }
+
+  masks_type::query_type query = entity_system::detail::make_mask_words<2>({3, 70});
+  std::vector<size_t> found;
+  masks.for_each_match(query, [&](size_t index)
+  {
+    found.push_back(index);
+  });
+  BOOST_REQUIRE_EQUAL(found.size(), 167u);
+  for(size_t i = 0 ; i < found.size() ; ++i)
+  {
+    BOOST_CHECK_EQUAL(found[i], i * 6);
+    BOOST_CHECK(masks.test(found[i], query));
+  }
+
+  // reset during the scan
+  size_t len = 0;
+  masks.for_each_match(query, [&](size_t index)
+  {
+    masks.clear(index + 6);
+    ++len;
+  });
+  BOOST_CHECK_EQUAL(len, 84u);
+
+  // bit 3 without bit 70
+  found.clear();
+  masks.for_each_match(entity_system::detail::make_mask_words<2>({3}), entity_system::detail::make_mask_words<2>({70}), [&](size_t index)
+  {
+    found.push_back(index);
+  });
+  BOOST_REQUIRE_EQUAL(found.size(), 333u);
+  for(size_t index : found)
+  {
+    BOOST_CHECK(index % 2 == 0 && index % 3 != 0);
+  }
+
+  masks.reset(0, query);
+  BOOST_CHECK(!masks.test(0, query));
+}
+
+BOOST_AUTO_TEST_CASE(dynamic_segment_reuse_lowest)
+{
+  counter_data = 0;
+  typedef entity_system::dynamic_segment<data, 8> segment_type;
+  segment_type segment;
+
+  std::vector<segment_type::id_type> ids;
+  for(uint32_t i = 0 ; i < 8 * 5000; ++i)
+  {
+    ids.push_back(segment.acquire(i).second);
+  }
+
+  segment.release(ids[8 * 4000 + 3]);
+  segment.release(ids[8 * 100 + 7]);
+  segment.release(ids[8 * 4500]);
+
+  BOOST_CHECK_EQUAL(segment.acquire(0).second, ids[8 * 100 + 7]);
+  BOOST_CHECK_EQUAL(segment.acquire(0).second, ids[8 * 4000 + 3]);
+  BOOST_CHECK_EQUAL(segment.acquire(0).second, ids[8 * 4500]);
+
+  auto id = segment.acquire(0).second;
+  BOOST_CHECK_EQUAL(id.seg_nb, 5000u);
+  BOOST_CHECK_EQUAL(id.seg_id, 1u);
+
+  segment.clear();
+  BOOST_CHECK_EQUAL(counter_data, 0u);
+}
+
+BOOST_AUTO_TEST_CASE_TEMPLATE(dynamic_segment_reserve, segment_type, list_dynamic_segment_type)
+{
+  counter_data = 0;
+  segment_type segment;
+
+  segment.reserve(segment_type::size * 3);
+  BOOST_CHECK_EQUAL(segment.capacity(), segment_type::size * 3);
+
+  // contiguous segments
+  std::vector<data*> datas;
+  for(uint32_t i = 0 ; i < segment_type::size * 3; ++i)
+  {
+    datas.push_back(segment.acquire(i).first);
+  }
+  BOOST_CHECK_EQUAL(segment.capacity(), segment_type::size * 3);
+  BOOST_CHECK_EQUAL((size_t)((uint8_t*)datas[segment_type::size] - (uint8_t*)datas[0]),     sizeof(typename segment_type::segment_type));
+  BOOST_CHECK_EQUAL((size_t)((uint8_t*)datas[segment_type::size * 2] - (uint8_t*)datas[0]), 2 * sizeof(typename segment_type::segment_type));
+
+  // grow
+  segment.acquire(0);
+  BOOST_CHECK_EQUAL(segment.capacity(), segment_type::size * 6);
+  BOOST_CHECK_EQUAL(counter_data, segment_type::size * 3 + 1);
+
+  // clear keep memory
+  segment.clear();
+  BOOST_CHECK_EQUAL(counter_data, 0u);
+  BOOST_CHECK_EQUAL(segment.capacity(), segment_type::size * 6);
+  BOOST_CHECK_EQUAL(segment.acquire(0).first, datas[0]);
+
+  // dense index
+  for(size_t i : {0ul, 1ul, segment_type::size - 1, segment_type::size, segment_type::size * 5 + 3})
+  {
+    BOOST_CHECK_EQUAL(segment_type::to_index(segment_type::to_id(i)), i);
+  }
+}
+
+BOOST_AUTO_TEST_CASE_TEMPLATE(dynamic_segment_shrink, segment_type, list_dynamic_segment_type)
+{
+  counter_data = 0;
+  segment_type segment;
+
+  std::vector<typename segment_type::id_type> ids;
+  for(uint32_t i = 0 ; i < segment_type::size * 10; ++i)
+  {
+    ids.push_back(segment.acquire(i).second);
+  }
+  BOOST_CHECK_EQUAL(segment.capacity(), segment_type::size * 16);
+
+  // release during iteration, trailing segments are trimmed
+  size_t count = 0;
+  for(data* d : segment)
+  {
+    if(d->value >= segment_type::size)
+    {
+      segment.release(ids[d->value]);
+    }
+    ++count;
+  }
+  BOOST_CHECK_EQUAL(count, segment_type::size * 10);
+  BOOST_CHECK_EQUAL(counter_data, segment_type::size);
+
+  // far from used : last blocks are given back
+  BOOST_CHECK_EQUAL(segment.capacity(), segment_type::size * 2);
+
+  // interior empty segment
+  ids.erase(ids.begin() + segment_type::size, ids.end());
+  for(uint32_t i = segment_type::size ; i < segment_type::size * 3; ++i)
+  {
+    ids.push_back(segment.acquire(i).second);
+  }
+  for(uint32_t i = segment_type::size ; i < segment_type::size * 2; ++i)
+  {
+    segment.release(ids[i]);
+  }
+  segment.shrink_to_fit();
+  BOOST_CHECK_EQUAL(segment.capacity(), segment_type::size * 4);
+
+  count = 0;
+  for(data* d : segment)
+  {
+    BOOST_CHECK(d->value < segment_type::size || d->value >= segment_type::size * 2);
+    ++count;
+  }
+  BOOST_CHECK_EQUAL(count, segment_type::size * 2);
+
+  // empty segment is reused first
+  BOOST_CHECK_EQUAL(segment.acquire(0).second.seg_nb, 1u);
+
+  // release all
+  segment.clear();
+  segment.shrink_to_fit();
+  BOOST_CHECK_EQUAL(segment.capacity(), 0u);
+  BOOST_CHECK_EQUAL(counter_data, 0u);
+
+  segment.acquire(0);
+  BOOST_CHECK_EQUAL(segment.capacity(), segment_type::size);
+  segment.clear();
+}
+
+BOOST_AUTO_TEST_CASE(dynamic_segment_reserve_not_trimmed)
+{
+  counter_data = 0;
+  typedef entity_system::dynamic_segment<data, 8> segment_type;
+  segment_type segment;
+
+  segment.acquire(0);
+  segment.reserve(8 * 100);
+  BOOST_CHECK_EQUAL(segment.capacity(), 8 * 100u);
+
+  auto id = segment.acquire(1).second;
+  segment.release(id);
+  BOOST_CHECK_EQUAL(segment.capacity(), 8 * 100u);
+
+  segment.shrink_to_fit();
+  BOOST_CHECK_EQUAL(segment.capacity(), 8u);
+  segment.clear();
+}
+
+BOOST_AUTO_TEST_CASE_TEMPLATE(dynamic_segment_compact, segment_type, list_dynamic_segment_type)
+{
+  counter_data = 0;
+  segment_type segment;
+
+  std::vector<typename segment_type::id_type> ids;
+  for(uint32_t i = 0 ; i < segment_type::size * 4; ++i)
+  {
+    ids.push_back(segment.acquire(i).second);
+  }
+
+  // keep 2 per segment
+  for(uint32_t i = 0 ; i < ids.size() ; ++i)
+  {
+    if(i % segment_type::size > 1)
+    {
+      segment.release(ids[i]);
+    }
+  }
+
+  std::map<uint32_t, typename segment_type::id_type> moves;
+  size_t moved = segment.compact(100, [&](data& d, typename segment_type::id_type from, typename segment_type::id_type to)
+  {
+    BOOST_CHECK_EQUAL(from, ids[d.value]);
+    moves.emplace(d.value, to);
+  });
+  BOOST_CHECK_EQUAL(moved, 6u);
+  BOOST_CHECK_EQUAL(moves.size(), 6u);
+  BOOST_CHECK_EQUAL(counter_data, 8u);
+
+  // all in first segment
+  std::set<uint32_t> values;
+  for(data* d : segment)
+  {
+    values.insert(d->value);
+  }
+  BOOST_CHECK_EQUAL(values.size(), 8u);
+  for(auto& m : moves)
+  {
+    BOOST_CHECK_EQUAL(m.second.seg_nb, 0u);
+    BOOST_CHECK_EQUAL(segment.get(m.second)->value, m.first);
+  }
+
+  BOOST_CHECK_EQUAL(segment.compact(100), 0u);
+  segment.clear();
+  BOOST_CHECK_EQUAL(counter_data, 0u);
+}